@@ -0,0 +1,126 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "NSBInterpreter.hpp"
+#include "NSBContext.hpp"
+#include "ResourceMgr.hpp"
+#include "nsbmagic.hpp"
+#include "scriptfile.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+/*
+ * Instructions per second of the script dispatch loop. The same script is
+ * run through the old per-instruction dispatch (Builtins lookup, runnable
+ * checks and the "__main__" compare on every instruction) and through
+ * RunThread with its pre-bound handlers. Only arithmetic and control flow
+ * builtins run, so no window or GL context is needed.
+ * */
+using namespace std::chrono;
+
+static uint64_t GetTime()
+{
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* Script =
+    "chapter main\n"
+    "{\n"
+    "    $i = 0;\n"
+    "    $j = 0;\n"
+    "    while (1 == 1)\n"
+    "    {\n"
+    "        $i = $i + 1;\n"
+    "        $j += $i;\n"
+    "        if ($i > 1000)\n"
+    "        {\n"
+    "            $i = 0;\n"
+    "        }\n"
+    "    }\n"
+    "}\n";
+
+class BenchResourceMgr : public ResourceMgr
+{
+protected:
+    ScriptFile* ReadScriptFile(const string& Path)
+    {
+        return new ScriptFile(Path, ScriptFile::NSS);
+    }
+};
+
+class BenchInterpreter : public NSBInterpreter
+{
+public:
+    BenchInterpreter(const string& Filename) : NSBInterpreter(nullptr)
+    {
+        ExecuteLocalScript(Filename);
+    }
+
+    // RunCommand as it was before handlers were bound per script
+    uint64_t RunLegacy(uint64_t Budget)
+    {
+        uint64_t Count = 0;
+        uint64_t Start = GetTime();
+        pContext = Threads.front();
+        while (GetTime() - Start < Budget)
+        {
+            while (pContext->IsActive() && !pContext->IsStarving() && !pContext->IsSleeping() && pContext->Advance() != MAGIC_CLEAR_PARAMS)
+            {
+                if (pContext->GetName() == "__main__")
+                    DebuggerTick();
+
+                if (pContext->GetMagic() < Builtins.size())
+                    Call(pContext->GetMagic());
+                ++Count;
+            }
+            ClearParams();
+        }
+        return Count;
+    }
+
+    uint64_t RunBound(uint64_t Budget)
+    {
+        uint64_t Begin = GetNumInstructions();
+        uint64_t Start = GetTime();
+        while (GetTime() - Start < Budget)
+            Run(Budget);
+        return GetNumInstructions() - Begin;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    const uint64_t Budget = 2000000;
+    string Filename = argc > 1 ? argv[1] : "dispatch-bench.nss";
+    if (argc <= 1)
+        ofstream(Filename) << Script;
+
+    sResourceMgr = new BenchResourceMgr;
+
+    BenchInterpreter Legacy(Filename);
+    uint64_t Before = Legacy.RunLegacy(Budget);
+    BenchInterpreter Bound(Filename);
+    uint64_t After = Bound.RunBound(Budget);
+
+    double Seconds = Budget / 1000000.0;
+    cout << "before: " << uint64_t(Before / Seconds) << " instructions/s" << endl;
+    cout << "after:  " << uint64_t(After / Seconds) << " instructions/s" << endl;
+    if (Before)
+        cout << "speedup: " << double(After) / Before << "x" << endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "GLTexture.hpp"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+/*
+ * Downcast throughput of ObjectCast against dynamic_cast, alone and as
+ * part of a Get<Texture> style handle lookup. BenchTexture stands in for
+ * Texture: it has the same TYPE bit and reaches Object through the same
+ * virtual base, but does not need a window. Lookups cycle through plain
+ * objects, GLTextures and BenchTextures, so both hits and misses count.
+ * */
+using namespace std::chrono;
+
+class BenchTexture : public GLTexture
+{
+public:
+    static const uint16_t TYPE = TYPE_TEXTURE;
+
+    BenchTexture()
+    {
+        Types |= TYPE;
+    }
+};
+
+static const int NUM_OBJECTS = 300;
+static const int NUM_ROUNDS = 20000;
+
+// Nanoseconds per lookup
+template <class F> static double Measure(F Func)
+{
+    auto Start = steady_clock::now();
+    for (int i = 0; i < NUM_ROUNDS; ++i)
+        Func();
+    return duration<double, nano>(steady_clock::now() - Start).count() / NUM_ROUNDS / NUM_OBJECTS;
+}
+
+int main()
+{
+    ObjectHolder_t Holder;
+    vector<Object*> Objects;
+    vector<string> Handles;
+    for (int i = 0; i < NUM_OBJECTS; ++i)
+    {
+        Object* pObject;
+        switch (i % 3)
+        {
+            case 0: pObject = new Object; break;
+            case 1: pObject = new GLTexture; break;
+            default: pObject = new BenchTexture; break;
+        }
+        Objects.push_back(pObject);
+        Handles.push_back("bench" + to_string(i));
+        Holder.Write(Handles.back(), pObject);
+    }
+
+    size_t Found = 0;
+    double CastBefore = Measure([&]
+    {
+        for (Object* pObject : Objects)
+            Found += dynamic_cast<BenchTexture*>(pObject) != nullptr;
+    });
+    double CastAfter = Measure([&]
+    {
+        for (Object* pObject : Objects)
+            Found += ObjectCast<BenchTexture>(pObject) != nullptr;
+    });
+    double GetBefore = Measure([&]
+    {
+        for (const string& Handle : Handles)
+            Found += dynamic_cast<BenchTexture*>(Holder.Read(Handle)) != nullptr;
+    });
+    double GetAfter = Measure([&]
+    {
+        for (const string& Handle : Handles)
+            Found += ObjectCast<BenchTexture>(Holder.Read(Handle)) != nullptr;
+    });
+
+    cout << "cast before: " << CastBefore << " ns, after: " << CastAfter << " ns" << endl;
+    cout << "Get<Texture> before: " << GetBefore << " ns, after: " << GetAfter << " ns" << endl;
+    cout << "(" << Found << " hits)" << endl;
+    return 0;
+}
@@ -0,0 +1,151 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+using namespace std;
+
+struct Operand
+{
+    enum
+    {
+        NONE = 0,
+        INT = 1,
+        FLOAT = 2,
+        STRING = 3,
+        LABEL = 4, // Int is the line number of the label
+        CALL = 5, // Int is the index of the CallTarget
+        VARIABLE = 6 // Str is the name of the variable
+    };
+
+    uint32_t Str;
+    uint8_t Type;
+    union
+    {
+        int32_t Int;
+        float Float;
+    };
+};
+
+/*
+ * Values of a string when it is used as one of the Nsb constants (see:
+ * nsbconstants.hpp). They are computed once for every string literal when
+ * its script is decoded, so builtins do not look them up at runtime.
+ * Only literals are covered: strings built at runtime are still looked up
+ * through Nsb::ConstantToValue by the Pop functions.
+ * */
+struct StringConstants
+{
+    bool Resolved;
+    int32_t Tempo;
+    int32_t Request;
+    int32_t Tone;
+    int32_t Effect;
+    int32_t Shade;
+    uint32_t Color;
+};
+
+class Bytecode;
+struct CallTarget
+{
+    uint32_t Symbol;
+    uint32_t Generation;
+    Bytecode* pCode;
+    uint32_t CodeLine;
+};
+
+/*
+ * A superinstruction replaces an instruction and the Length - 1 following
+ * ones. The covered instructions are left in place, so line numbers and
+ * the original code stay valid, and are skipped over at runtime.
+ * */
+struct Instruction
+{
+    enum
+    {
+        SUPER_NONE = 0,
+        SUPER_PUSH_INT = 1, // Value
+        SUPER_CMP_BRANCH = 2, // Lhs, Rhs, Compare magic, Label, Branch magic
+        SUPER_ADD_ASSIGN = 3, // Lhs, Rhs, Variable
+        SUPER_INCREMENT = 4 // Variable, Increment/Decrement magic
+    };
+
+    uint16_t Magic;
+    uint16_t NumParams;
+    uint32_t Params;
+    uint16_t Super;
+    uint16_t Length;
+    uint32_t SuperParams;
+};
+
+/*
+ * Decoded form of a ScriptFile. Every line is turned into an Instruction
+ * whose parameters are interned and, where the type is known at load time
+ * (literals, subscript depth), already parsed into immediates. Labels are
+ * resolved to line numbers up front, while function calls are resolved on
+ * first use and cached until the set of loaded scripts changes.
+ * Instructions are indexed by the same line numbers as the ScriptFile.
+ * */
+class Line;
+class ScriptFile;
+class Bytecode
+{
+public:
+    Bytecode(ScriptFile* pScript);
+
+    ScriptFile* GetScript() { return pScript; }
+    Instruction* GetInstruction(uint32_t LineNumber) { return &Code[LineNumber]; }
+    const Operand& GetOperand(Instruction* pInst, uint32_t Index) { return Operands[pInst->Params + Index]; }
+    const Operand& GetSuperOperand(Instruction* pInst, uint32_t Index) { return Operands[pInst->SuperParams + Index]; }
+    CallTarget& ResolveCall(const Operand& Op);
+    uint32_t GetSize() { return Code.size(); }
+
+    static uint32_t Intern(const string& Str);
+    static const string& GetString(uint32_t Id) { return Strings[Id]; }
+    static const StringConstants* GetConstants(uint32_t Id);
+    static uint32_t ParseColor(const string& Str);
+
+private:
+    void Decode(Instruction* pInst, Line* pLine);
+    void DecodeLabel(Operand& Op, const string& Label);
+    static void ResolveConstants(uint32_t Id);
+
+    void Optimize();
+    void FoldConstants(const vector<bool>& Targets);
+    bool GetConstant(uint32_t Index, int32_t& Value, uint32_t& Length);
+    bool GetSource(uint32_t Index, Operand& Op);
+    bool IsMagic(uint32_t Index, uint16_t Magic);
+    bool CanFuse(const vector<bool>& Targets, uint32_t Begin, uint32_t Length);
+    void Fuse(uint32_t Index, uint16_t Super, uint16_t Length, const vector<Operand>& Ops);
+
+    ScriptFile* pScript;
+    vector<Instruction> Code;
+    vector<Operand> Operands;
+    vector<CallTarget> Calls;
+
+    static deque<string> Strings;
+    static unordered_map<string, uint32_t> StringIds;
+    static deque<StringConstants> Constants;
+};
+
+#endif
@@ -33,6 +33,8 @@ class Choice : public Name
     };
 
 public:
+    static const uint16_t TYPE = TYPE_CHOICE;
+
     Choice();
 
     bool IsSelected(const SDL_Event& Event);
@@ -174,6 +174,11 @@ public:
         Reset(this->EndX, EndX, this->EndY, EndY, Time, Tempo);
     }
 
+    bool IsDone()
+    {
+        return ElapsedTime >= Time;
+    }
+
     float GetProgress()
     {
         if (ElapsedTime >= Time)
@@ -305,17 +310,30 @@ public:
     {
         CreateFromFile(Filename, true);
         LerpEffect::Reset(StartOpacity, EndOpacity, 0, 0, Time, Tempo);
+        this->Boundary = Boundary;
+        Bound = false;
+    }
 
-        if (!Program)
-            return;
-
-        glUseProgramObjectARB(Program);
-        glActiveTextureARB(GL_TEXTURE1_ARB);
-        glBindTexture(GL_TEXTURE_2D, GLTextureID);
-        glUniform1iARB(glGetUniformLocationARB(Program, "Mask"), 1);
-        glActiveTextureARB(GL_TEXTURE0_ARB);
-        glUniform1fARB(glGetUniformLocationARB(Program, "Boundary"), Boundary * 0.001f);
+    void OnDraw(int32_t diff)
+    {
+        // The mask is bound once it has been decoded and uploaded
+        if (!Bound && Program)
+        {
+            Upload();
+            Bound = true;
+            glUseProgramObjectARB(Program);
+            glActiveTextureARB(GL_TEXTURE1_ARB);
+            glBindTexture(GL_TEXTURE_2D, GLTextureID);
+            glUniform1iARB(glGetUniformLocationARB(Program, "Mask"), 1);
+            glActiveTextureARB(GL_TEXTURE0_ARB);
+            glUniform1fARB(glGetUniformLocationARB(Program, "Boundary"), Boundary * 0.001f);
+        }
+        FadeEffect::OnDraw(diff);
     }
+
+private:
+    int32_t Boundary;
+    bool Bound;
 };
 
 class BlurEffect : public Effect, GLTexture
@@ -20,14 +20,40 @@
 
 #include <SDL2/SDL_opengl.h>
 #include "Object.hpp"
+#include <memory>
 
 class Image;
 class Window;
 class Texture;
+
+/*
+ * GL texture name shared by every GLTexture which shows it and by the
+ * TextureCache. The name is deleted along with the last reference.
+ * */
+struct TextureData
+{
+    TextureData();
+    ~TextureData();
+
+    void Upload(uint8_t* Pixels, GLenum Format);
+    void Resolve();
+
+    GLuint ID;
+    int Width, Height;
+    bool Cached;
+
+    // Image still being decoded by the ImagePool, uploaded on first use
+    shared_ptr<Image> pPending;
+    int ClipX, ClipY;
+};
+typedef shared_ptr<TextureData> TextureRef;
+
 class GLTexture : virtual public Object
 {
     friend class Texture;
 public:
+    static const uint16_t TYPE = TYPE_GLTEXTURE;
+
     GLTexture();
     virtual ~GLTexture();
 
@@ -46,9 +72,13 @@ public:
 
 protected:
     void SetSmoothing(bool Set);
+    void Share(TextureRef pData);
+    void Upload();
+    void Detach();
 
     int Width, Height;
     GLuint GLTextureID;
+    TextureRef pData;
 };
 
 #endif
@@ -20,28 +20,40 @@
 
 #include <SDL2/SDL_opengl.h>
 #include "Object.hpp"
+#include <future>
+#include <memory>
+
+class Image;
+typedef shared_future<shared_ptr<Image>> ImageFuture;
 
 class Image : public Object
 {
 public:
+    static const uint16_t TYPE = TYPE_IMAGE;
+
     Image();
     ~Image();
 
-    GLenum GetFormat() const { return Format; }
+    GLenum GetFormat() { Wait(); return Format; }
     int GetWidth() const { return Width; }
     int GetHeight() const { return Height; }
-    uint8_t* GetPixels() const { return pPixels; }
+    uint8_t* GetPixels() { Wait(); return pPixels; }
     void LoadColor(int Width, int Height, uint32_t Color);
     void LoadImage(const string& Filename, bool Mask = false);
+    void LoadImage(Resource Res, const string& Filename, bool Mask);
+    void LoadImageAsync(const string& Filename, bool Mask = false);
     void LoadScreen(Window* pWindow);
 
 private:
     uint8_t* LoadPNG(uint8_t* pMem, uint32_t Size, uint8_t Format);
     uint8_t* LoadJPEG(uint8_t* pMem, uint32_t Size);
+    void Decode(uint8_t* pData, uint32_t Size, const string& Filename, bool Mask);
+    void Wait();
 
     GLenum Format;
     int Width, Height;
     uint8_t* pPixels;
+    ImageFuture Pending;
 };
 
 #endif
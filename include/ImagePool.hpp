@@ -0,0 +1,57 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef IMAGE_POOL_HPP
+#define IMAGE_POOL_HPP
+
+#include "Image.hpp"
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Worker threads which read and decode image files off the main thread.
+ * Workers read through Resource rather than the virtual ResourceMgr::Read,
+ * which subclasses may override without locking. The returned future is waited on by Image once the pixels are needed.
+ * The pool is started and shut down by Window. Shutdown must happen while
+ * sResourceMgr is alive; jobs still queued by then resolve to empty images,
+ * and later requests are decoded by the caller.
+ * */
+class ImagePool
+{
+public:
+    static void Start();
+    static void Shutdown();
+    static ImageFuture Decode(Resource Res, const string& Filename, bool Mask);
+
+private:
+    typedef packaged_task<shared_ptr<Image>(bool)> Job;
+
+    static void Run();
+
+    static vector<thread> Workers;
+    static deque<Job> Jobs;
+    static mutex JobsLock;
+    static condition_variable JobsReady;
+    static bool Running;
+    static atomic<bool> Cancelled;
+};
+
+#endif
@@ -31,6 +31,8 @@ public:
 
     virtual void Request(int32_t State) { Playable::Request(State); }
     void Draw(uint32_t Diff);
+    bool IsAnimating() { return Playing || Texture::IsAnimating(); }
+    bool Action() { return Playable::Action(); }
 private:
     void InitVideo(Window* pWindow);
     void UpdateSample();
@@ -19,6 +19,7 @@
 #define NSB_CONTEXT_HPP
 
 #include "Object.hpp"
+#include "Bytecode.hpp"
 #include <stack>
 #include <cstdint>
 
@@ -30,55 +31,71 @@ class NSBContext : public Object
     struct StackFrame
     {
         ScriptFile* pScript;
+        Bytecode* pCode;
         uint32_t SourceLine;
     };
 public:
+    static const uint16_t TYPE = TYPE_CONTEXT;
+
     NSBContext(const string& Name);
     ~NSBContext();
 
     bool Call(ScriptFile* pScript, const string& Symbol);
-    void Jump(const string& Symbol);
+    void Call(Bytecode* pCode, uint32_t CodeLine);
+    void Jump(uint32_t CodeLine);
     void Break();
     const string& GetParam(uint32_t Index);
+    const Operand& GetOperand(uint32_t Index);
     int GetNumParams();
     const string& GetScriptName();
     ScriptFile* GetScript();
+    Bytecode* GetCode();
     Line* GetLine();
+    Instruction* GetInstruction();
     uint32_t GetLineNumber();
     uint32_t GetMagic();
     uint32_t Advance();
     void Rewind();
+    void Skip(uint32_t Count);
     void Return();
     void PushBreak();
+    void PushBreak(uint32_t CodeLine);
     void PopBreak();
     void WaitText(Text* pText, int32_t Time);
     void WaitAction(Object* pObject, int32_t Time);
     void WaitKey(int32_t Time);
     void Wait(int32_t Time, bool Interrupt = false);
     void Wake();
-    void TryWake();
     void OnClick();
     bool IsStarving();
     bool IsSleeping();
     bool IsActive();
+    bool IsRunnable();
+    bool IsWaitingText();
+    Object* GetWaitObject();
+    uint32_t GetWaitSerial();
+    uint64_t GetWaitTime();
     void Start();
     void Request(int32_t State);
     const string& GetName();
     void WriteTrace(ostream& Stream);
-    void Update(uint32_t Diff);
+    void GetTrace(vector<pair<Bytecode*, uint32_t>>& Frames);
+
+    bool Scheduled; // In NSBInterpreter's ready queue
+    uint64_t ReportedLimit; // Slice limit this thread was last reported over
 
 private:
     StackFrame* GetFrame();
 
     Text* pText;
     Object* pObject;
+    uint32_t WaitSerial; // pObject->Serial, pObject may be deleted meanwhile
     const string Name;
     uint64_t WaitTime;
-    uint64_t Elapsed;
     bool WaitInterrupt;
     bool Active;
     stack<StackFrame> CallStack;
-    stack<string> BreakStack;
+    stack<pair<Bytecode*, uint32_t>> BreakStack;
 };
 
 #endif
@@ -20,18 +20,35 @@
 
 #include "Variable.hpp"
 #include "Choice.hpp"
+#include "Bytecode.hpp"
+#include "Profiler.hpp"
 #include <SDL2/SDL.h>
 #include <functional>
 #include <queue>
+#include <atomic>
 #include <thread>
 #include <list>
 using namespace std;
 
+/*
+ * Expression stack. Temporaries are taken from an arena owned by the stack
+ * and are all reclaimed at once by Reset (see: MAGIC_CLEAR_PARAMS), so once
+ * the arena has grown to fit the largest statement no more Variables are
+ * allocated. That is all NumAllocs counts: strings too long to be stored
+ * inline still allocate (see: Variable::NumStringAllocs), and the
+ * std::string copies returned by PopString and ToString are not counted.
+ * */
 class Stack
 {
 public:
-    Stack() : ReadIndex(0), WriteIndex(0)
+    Stack() : ReadIndex(0), WriteIndex(0), EndIndex(0), NumTemps(0), NumAllocs(0)
+    {
+    }
+
+    ~Stack()
     {
+        for (Variable* pVar : Temps)
+            delete pVar;
     }
 
     void Push(Variable* pVar)
@@ -62,27 +79,173 @@ public:
     {
         WriteIndex -= Size;
         ReadIndex = WriteIndex;
+        EndIndex = ReadIndex + Size;
+    }
+
+    // Whether the current call has parameters left to pop
+    bool HasNext()
+    {
+        return ReadIndex < EndIndex;
+    }
+
+    Variable* Temporary()
+    {
+        if (NumTemps == Temps.size())
+        {
+            Temps.push_back(new Variable);
+            NumAllocs++;
+        }
+        Variable* pVar = Temps[NumTemps++];
+        pVar->ClearArray();
+        pVar->Initialize();
+        pVar->Relative = false;
+        return pVar;
     }
 
     void Reset()
     {
         ReadIndex = WriteIndex = 0;
-        Params.clear();
+        NumTemps = 0;
+    }
+
+    uint64_t GetNumAllocs()
+    {
+        return NumAllocs;
+    }
+
+    size_t GetArenaSize()
+    {
+        return Temps.size();
     }
 
 private:
     vector<Variable*> Params;
+    vector<Variable*> Temps;
     size_t ReadIndex;
     size_t WriteIndex;
+    size_t EndIndex;
+    size_t NumTemps;
+    uint64_t NumAllocs;
 };
 
-typedef function<int32_t(int32_t)> PosFunc;
+/*
+ * Variables are owned by the name ordered Cache, which is used for saving
+ * and array scans, and are additionally indexed by their interned name
+ * (see: Bytecode::Intern) so that script accesses resolve in O(1).
+ * */
+class VariableHolder_t : public Holder<Variable>
+{
+    struct Slot
+    {
+        Variable* pVar;
+        bool Watched;
+    };
+public:
+    Variable* Read(uint32_t Id)
+    {
+        return Id < Slots.size() ? Slots[Id].pVar : nullptr;
+    }
+
+    void Write(uint32_t Id, Variable* pVar)
+    {
+        Holder::Write(Bytecode::GetString(Id), pVar);
+        Resize(Id);
+        Slots[Id].pVar = pVar;
+    }
+
+    void Watch(uint32_t Id)
+    {
+        Resize(Id);
+        Slots[Id].Watched = true;
+    }
+
+    bool IsWatched(uint32_t Id)
+    {
+        return Id < Slots.size() && Slots[Id].Watched;
+    }
+
+private:
+    void Resize(uint32_t Id)
+    {
+        if (Id >= Slots.size())
+            Slots.resize(Id + 1, {nullptr, false});
+    }
+
+    vector<Slot> Slots;
+};
+
+/*
+ * Arguments of typed builtins (see: NSBInterpreter::Pop) are decoded into
+ * plain values. Screen relative positions keep the screen extent in Value
+ * and are resolved against the object size xy when applied.
+ * */
 struct NSBPosition
 {
-    NSBPosition() : Func(nullptr) { }
-    PosFunc Func;
+    enum PosType : uint8_t
+    {
+        VALUE, // Value
+        END, // Value - xy
+        ON, // Value - xy / 2
+        SIZE, // xy
+        CENTER // (Value - xy) / 2
+    } Type;
     bool Relative;
-    int32_t operator()(int32_t xy, int32_t Old = 0) { return Relative ? Old + Func(xy) : Func(xy); }
+    int32_t Value;
+    int32_t operator()(int32_t xy, int32_t Old = 0) const;
+};
+
+// Position which is always a number
+struct NSBRelative : NSBPosition
+{
+};
+
+struct NSBTempo
+{
+    int32_t Value;
+    operator int32_t() const { return Value; }
+};
+
+struct NSBRequest
+{
+    int32_t Value;
+    operator int32_t() const { return Value; }
+};
+
+struct NSBTone
+{
+    int32_t Value;
+    operator int32_t() const { return Value; }
+};
+
+struct NSBShade
+{
+    int32_t Value;
+    operator int32_t() const { return Value; }
+};
+
+// Trailing argument which may be left out (see: NSB_TYPED_VARARGS)
+struct NSBOptional
+{
+    bool Present;
+    int32_t Value;
+    int32_t Or(int32_t Default) const { return Present ? Value : Default; }
+};
+
+/*
+ * Argument passed as const string&. Refers to the interned string when
+ * the argument is a literal, so handles are not copied.
+ * */
+class NSBString
+{
+public:
+    explicit NSBString(const string* pInterned) : pStr(pInterned) { }
+    explicit NSBString(string&& Str) : Owned(move(Str)), pStr(&Owned) { }
+    NSBString(NSBString&& Other) : Owned(move(Other.Owned)), pStr(Other.pStr == &Other.Owned ? &Owned : Other.pStr) { }
+    operator const string&() const { return *pStr; }
+
+private:
+    string Owned;
+    const string* pStr;
 };
 
 class Line;
@@ -100,6 +263,7 @@ class NSBInterpreter
         BuiltinFunc Func;
         uint8_t NumParams;
     };
+    template <class F, F Func> struct Thunk;
     struct NSBShortcut
     {
         SDL_Keycode Key;
@@ -115,10 +279,15 @@ public:
     void StartDebugger();
 
     void PushEvent(const SDL_Event& Event);
+    void OnSignal(uint32_t Serial);
     virtual void HandleEvent(const SDL_Event& Event);
     void Update(uint32_t Diff);
-    void Run(int NumCommands);
+    void Run(uint64_t Budget);
     void RunCommand();
+    bool IsIdle();
+    uint64_t GetNextDeadline();
+    uint64_t GetNumInstructions() { return NumInstructions; }
+    void SetSliceLimit(uint64_t Limit) { SliceLimit = Limit; }
 
 protected:
     void FunctionDeclaration();
@@ -160,17 +329,17 @@ protected:
     void ModAssign();
     void WriteFile();
     void ReadFile();
-    void CreateTexture();
-    void ImageHorizon();
-    void ImageVertical();
+    void CreateTexture(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, const string& Source);
+    void ImageHorizon(Texture* pTexture);
+    void ImageVertical(Texture* pTexture);
     void Time();
     void StrStr();
     void Exit();
     void CursorPosition();
     void MoveCursor();
     void Position();
-    void Wait();
-    void WaitKey();
+    void Wait(int32_t Time);
+    void WaitKey(NSBOptional Time);
     void NegaExpression();
     void System();
     void String();
@@ -181,40 +350,40 @@ protected:
     void SubScript();
     void AssocArray();
     void ModuleFileName();
-    void Request();
-    void SetVertex();
-    void Zoom();
-    void Move();
-    void SetShade();
-    void DrawToTexture();
+    void Request(const string& Handle, NSBRequest Request);
+    void SetVertex(Texture* pTexture, NSBPosition X, NSBPosition Y);
+    void Zoom(const string& Handle, int32_t Time, NSBRelative XScale, NSBRelative YScale, NSBTempo Tempo, bool Wait);
+    void Move(const string& Handle, int32_t Time, NSBPosition X, NSBPosition Y, NSBTempo Tempo, bool Wait);
+    void SetShade(Texture* pTexture, NSBShade Shade);
+    void DrawToTexture(GLTexture* pTexture, int32_t X, int32_t Y, const string& Filename);
     void CreateRenderTexture();
-    void DrawTransition();
-    void CreateColor();
-    void LoadImage();
-    void Fade();
-    void Delete();
+    void DrawTransition(Texture* pTexture, int32_t Time, int32_t Start, int32_t End, int32_t Boundary, NSBTempo Tempo, const string& Filename, bool Wait);
+    void CreateColor(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, int32_t Width, int32_t Height, uint32_t Color);
+    void LoadImage(const string& Handle, const string& Filename);
+    void Fade(const string& Handle, int32_t Time, int32_t Opacity, NSBTempo Tempo, bool Wait);
+    void Delete(const string& Handle);
     void ClearParams();
-    void SetLoop();
-    void SetVolume();
-    void SetLoopPoint();
-    void CreateSound();
-    void RemainTime();
-    void CreateMovie();
-    void DurationTime();
-    void SetFrequency();
-    void SetPan();
-    void SetAlias();
-    void CreateName();
-    void CreateWindow();
+    void SetLoop(Playable* pPlayable, bool Loop);
+    void SetVolume(const string& Handle, int32_t Time, int32_t Volume, NSBTempo Tempo);
+    void SetLoopPoint(Playable* pPlayable, int32_t Begin, int32_t End);
+    void CreateSound(const string& Handle, const string& Type, string File);
+    void RemainTime(Playable* pPlayable);
+    void CreateMovie(const string& Handle, int32_t Priority, Variable* X, Variable* Y, bool Loop, bool Alpha, const string& File, bool Audio);
+    void DurationTime(Playable* pPlayable);
+    void SetFrequency(const string& Handle, int32_t Time, int32_t Frequency, NSBTempo Tempo);
+    void SetPan(const string& Handle, int32_t Time, int32_t Pan, NSBTempo Tempo);
+    void SetAlias(const string& Handle, const string& Alias);
+    void CreateName(const string& Handle);
+    void CreateWindow(const string& Handle, int32_t Priority, int32_t X, int32_t Y, int32_t Width, int32_t Height, Variable* unk);
     void CreateChoice();
     void Case();
     void CaseEnd();
-    void SetNextFocus();
-    void PassageTime();
+    void SetNextFocus(const string& First, const string& Second, const string& Key);
+    void PassageTime(Playable* pPlayable);
     void ParseText();
     void LoadText();
-    void WaitText();
-    void LockVideo();
+    void WaitText(const string& Handle, int32_t Time);
+    void LockVideo(Variable* Lock);
     void Save();
     void DeleteSaveFile();
     void Conquest();
@@ -222,44 +391,45 @@ protected:
     void ClearBacklog();
     void SetFont();
     void SetShortcut();
-    void CreateClipTexture();
+    void CreateClipTexture(const string& Handle, int32_t Priority, NSBPosition X1, NSBPosition Y1, int32_t X2, int32_t Y2, int32_t Width, int32_t Height, const string& Source);
     void ExistSave();
-    void WaitAction();
+    void WaitAction(const string& Handle, NSBOptional Time);
     void Load();
     void SetBacklog();
-    void CreateText();
+    void CreateText(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, NSBPosition Width, NSBPosition Height, const string& String);
     void AtExpression();
     void Random();
-    void CreateEffect();
-    void SetTone();
+    void CreateEffect(const string& Handle, Variable* Priority, NSBPosition X, NSBPosition Y, Variable* Width, Variable* Height, Variable* Effect);
+    void SetTone(Texture* pTexture, NSBTone Tone);
     void DateTime();
-    void Shake();
-    void MoviePlay();
-    void SetStream();
-    void WaitPlay();
-    void WaitFade();
-    void SoundAmplitude();
-    void Rotate();
+    void Shake(const string& Handle, int32_t Time, int32_t XWidth, int32_t YWidth, Variable* unk1, Variable* unk2, Variable* unk3, Variable* Tempo, bool Wait);
+    void MoviePlay(Variable* File, Variable* unk);
+    void SetStream(Variable* Handle, Variable* unk);
+    void WaitPlay(Playable* pPlayable, Variable* unk);
+    void WaitFade(Texture* pTexture, Variable* unk);
+    void SoundAmplitude(Variable* Handle, Variable* unk);
+    void Rotate(Texture* pTexture, int32_t Time, Variable* X, Variable* Y, NSBRelative Z, NSBTempo Tempo, bool Wait);
     void Message();
     void Integer();
     void CreateScrollbar();
     void SetScrollbarValue();
     void SetScrollbarWheelArea();
     void ScrollbarValue();
-    void CreateStencil();
-    void CreateMask();
+    void CreateStencil(const string& Handle, Variable* unk1, NSBPosition X, NSBPosition Y, Variable* unk2, const string& Filename, Variable* unk3);
+    void CreateMask(const string& Handle, Variable* Priority, NSBPosition X, NSBPosition Y, const string& Filename, Variable* Inheritance);
 
     float PopFloat();
     int32_t PopInt();
     string PopString();
     NSBPosition PopPos();
-    NSBPosition PopRelative();
+    NSBRelative PopRelative();
     uint32_t PopColor();
     int32_t PopRequest();
     int32_t PopTone();
     int32_t PopEffect();
     int32_t PopShade();
-    int32_t PopTempo();
+    NSBTempo PopTempo();
+    int8_t GetPosIndex(Variable* pVar);
     bool PopBool();
     string PopSave();
     Variable* PopVar();
@@ -267,10 +437,14 @@ protected:
     GLTexture* PopGLTexture();
     Playable* PopPlayable();
     Scrollbar* PopScrollbar();
+    template <class T> T Pop();
+    template <class F, F Func> void Typed() { Thunk<F, Func>::Call(this); }
+    template <class F, F Func> static NSBFunction MakeTyped();
 
     void PushFloat(float Float);
     void PushInt(int32_t Int);
     void PushString(const string& Str);
+    void PushLiteral(uint32_t Id);
     void PushVar(Variable* pVar);
     void Assign_(int Index);
 
@@ -279,15 +453,23 @@ protected:
     void FloatBinaryOp(function<float(float, float)> Func);
     void BoolBinaryOp(function<bool(bool, bool)> Func);
 
+    void SetInt(uint32_t Id, int32_t Val);
     void SetInt(const string& Name, int32_t Val);
+    void SetString(uint32_t Id, const string& Val);
     void SetString(const string& Name, const string& Val);
+    void SetVar(uint32_t Id, Variable* pVar);
     void SetVar(const string& Name, Variable* pVar);
+    // Only called for variables registered with WatchVariable
     virtual void OnVariableChanged(const string& Name);
+    void WatchVariable(const string& Name);
     int32_t GetInt(const string& Name);
     string GetString(const string& Name);
     bool GetBool(const string& Name);
     bool ToBool(Variable* pVar);
+    Variable* GetVar(uint32_t Id);
     Variable* GetVar(const string& Name);
+    Variable* GetElement(Variable* pArr, int32_t Index);
+    Variable* ReadElement(const string& Name);
     Object* GetObject(const string& Name);
     template <class T> T* Get(const string& Name);
     void CallFunction_(NSBContext* pThread, const string& Symbol);
@@ -295,9 +477,20 @@ protected:
     void CallScript(const string& Filename, const string& Symbol);
     void CallScriptThread(const string& Filename, const string& Symbol);
     void Call(uint16_t Magic);
+    template <bool Debug, bool Profiling> void RunThread();
+    const NSBFunction* GetHandlers(Bytecode* pCode);
+    void Nop();
+    void SuperPushInt();
+    void SuperCmpBranch();
+    void SuperAddAssign();
+    void SuperIncrement();
+    bool FetchInt(const Operand& Op, int32_t& Val);
+    Variable* Fetch(const Operand& Op);
     bool SelectEvent();
     void AddThread(NSBContext* pThread);
     void RemoveThread(NSBContext* pThread);
+    void MakeReady(NSBContext* pThread);
+    bool Suspend(NSBContext* pThread);
     void ProcessKey(int Key, const string& Val);
     void ProcessButton(int button, const string& Val);
 
@@ -311,26 +504,54 @@ protected:
     bool LogCalls;
     bool DbgStepping;
     bool RunInterpreter;
-    list<pair<string, uint32_t>> Breakpoints;
+    // Breakpoint bitset of each script, indexed by line number
+    unordered_map<ScriptFile*, vector<bool>> Breakpoints;
+    Profiler Profile;
 
     bool SkipHack;
-    bool ThreadsModified;
     SDL_Event Event;
     queue<SDL_Event> Events;
     Window* pWindow;
     NSBContext* pContext;
     vector<NSBFunction> Builtins;
+    unordered_map<Bytecode*, vector<NSBFunction>> Handlers;
+    uint64_t NumInstructions;
     Stack Params;
+    // Named position of each string literal, by string id (see: PopPos)
+    vector<int8_t> PosIndices;
     vector<NSBShortcut> Shortcuts;
     vector<ScriptFile*> Scripts;
     list<NSBContext*> Threads;
-    Holder<Variable> VariableHolder;
+
+    /*
+     * Scheduler. Only threads in the Ready queue are run. A thread which
+     * goes to sleep is parked: timed waits on a min-heap of deadlines,
+     * WaitAction in Waiters until the object signals completion, Select
+     * until the next input event and WaitText until a click.
+     * Timers of threads woken early are invalidated by their ticket.
+     * */
+    struct Timer
+    {
+        uint64_t Deadline;
+        uint64_t Ticket;
+        NSBContext* pThread;
+        bool operator>(const Timer& Other) const { return Deadline > Other.Deadline; }
+    };
+    list<NSBContext*> Ready;
+    list<NSBContext*> Selecting;
+    unordered_multimap<uint32_t, NSBContext*> Waiters; // By Object::Serial
+    priority_queue<Timer, vector<Timer>, greater<Timer>> Timers;
+    unordered_map<NSBContext*, uint64_t> Sleeping;
+    uint64_t NextTicket;
+    uint64_t Clock;
+    atomic<uint64_t> SliceLimit; // Watchdog threshold in microseconds
+    VariableHolder_t VariableHolder;
     ObjectHolder_t ObjectHolder;
 };
 
 template <class T> T* NSBInterpreter::Get(const string& Name)
 {
-    return dynamic_cast<T*>(GetObject(Name));
+    return ObjectCast<T>(GetObject(Name));
 }
 
 #endif
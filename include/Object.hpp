@@ -20,34 +20,49 @@
 
 #include "ResourceMgr.hpp"
 #include "nsbconstants.hpp"
-#include <regex>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <unordered_map>
 
 struct Object;
-class ObjectHolder_t : private Holder<Object>
+/*
+ * Objects are owned by their parent holder and addressed by slash separated
+ * handles. Handles are interned into a trie of nodes the first time they are
+ * seen, so later lookups walk the cached nodes without splitting the handle
+ * or allocating. An alias in the first segment is expanded once and cached
+ * until the next WriteAlias. Child storage is only allocated for holders
+ * which have children. Node ids never outlive a single call, so the table
+ * can be dropped between statements (see: Trim) to keep generated handles
+ * from growing it forever.
+ * */
+class ObjectHolder_t
 {
+    struct HandleNode
+    {
+        string Path;
+        string Segment;
+        uint32_t Parent;
+        // Node with the alias expanded, valid if Generation is current
+        uint32_t Resolved;
+        uint32_t Generation;
+        // Some segment ends with '*'
+        bool Wildcard;
+    };
 public:
-    virtual ~ObjectHolder_t()
+    ObjectHolder_t() : pChildren(nullptr)
     {
     }
 
+    virtual ~ObjectHolder_t();
+
     Object* Read(const string& Handle)
     {
-        string Leftover = Handle;
-        string ObjHandle = ExtractObjHandle(Leftover);
-        if (Leftover.empty())
-            return Holder::Read(ObjHandle);
-        return GetHolder(ObjHandle)->Read(Leftover);
+        Object** ppObject = ReadPointer(Resolve(Intern(Handle)));
+        return ppObject ? *ppObject : nullptr;
     }
 
-    void Write(const string& Handle, Object* pObject)
-    {
-        string Leftover = Handle;
-        string ObjHandle = ExtractObjHandle(Leftover);
-        if (Leftover.empty())
-            Holder::Write(ObjHandle, pObject);
-        else
-            GetHolder(ObjHandle)->Write(Leftover, pObject);
-    }
+    void Write(const string& Handle, Object* pObject);
 
     void Delete(const string& Handle)
     {
@@ -56,21 +71,29 @@ public:
 
     template <class F>
     void Execute(const string& Handle, F Func)
+    {
+        uint32_t Node = Intern(Handle);
+        if (Nodes[Node].Wildcard)
+            ExecuteWildcard(Handle, Func);
+        else
+            CallSafe(ReadPointer(Resolve(Node)), Func);
+    }
+
+    void WriteAlias(const string& Handle, const string& Alias);
+    static void Trim();
+
+private:
+    template <class F>
+    void ExecuteWildcard(const string& Handle, F Func)
     {
         string Leftover = Handle;
         string ObjHandle = ExtractObjHandle(Leftover);
         if (ObjHandle.back() == '*')
             ObjHandle.front() == '@' ? WildcardAlias(Leftover, ObjHandle, Func) : WildcardCache(Leftover, ObjHandle, Func);
         else
-            Leftover.empty() ? CallSafe(ReadPointer(ObjHandle), Func) : ExecuteSafe(ObjHandle, Leftover, Func);
+            Leftover.empty() ? CallSafe(ReadChild(ObjHandle), Func) : ExecuteSafe(ObjHandle, Leftover, Func);
     }
 
-    void WriteAlias(const string& Handle, const string& Alias)
-    {
-        Aliases[Alias] = Handle;
-    }
-
-private:
     template <class F>
     void CallSafe(Object** ppObject, F Func)
     {
@@ -85,65 +108,72 @@ private:
             pHolder->Execute(Handle, Func);
     }
 
+    // Calls Func for every alias which starts with the wildcard's prefix
     template <class F>
     void WildcardAlias(const string& Leftover, const string& ObjHandle, F Func)
     {
-        std::regex Regex(Regexify(ObjHandle.substr(1)));
-        for (auto i = Aliases.begin(); i != Aliases.end(); ++i)
-            if (std::regex_match(i->first, Regex))
-                Leftover.empty() ? Execute(i->second, Func) : ExecuteSafe(i->second, Leftover, Func);
+        string Prefix = ObjHandle.substr(1, ObjHandle.size() - 2);
+        for (auto i = Aliases.lower_bound(Prefix); i != Aliases.end() && IsPrefix(Prefix, i->first); ++i)
+            Leftover.empty() ? Execute(i->second, Func) : ExecuteSafe(i->second, Leftover, Func);
     }
 
+    // Calls Func for every child which starts with the wildcard's prefix
     template <class F>
     void WildcardCache(const string& Leftover, const string& ObjHandle, F Func)
     {
-        std::regex Regex(Regexify(ObjHandle));
-        for (auto i = Cache.begin(); i != Cache.end(); ++i)
-            if (std::regex_match(i->first, Regex))
-                Leftover.empty() ? CallSafe(&i->second, Func) : ExecuteSafe(i->first, Leftover, Func);
-    }
+        if (!pChildren)
+            return;
 
-    string Regexify(const string& Wildcard)
-    {
-        return string("^" + Wildcard.substr(0, Wildcard.size() - 1) + ".*");
+        string Prefix = ObjHandle.substr(0, ObjHandle.size() - 1);
+        for (auto i = pChildren->lower_bound(Prefix); i != pChildren->end() && IsPrefix(Prefix, i->first); ++i)
+            Leftover.empty() ? CallSafe(&i->second, Func) : ExecuteSafe(i->first, Leftover, Func);
     }
 
-    string ExtractObjHandle(string& Handle)
+    static bool IsPrefix(const string& Prefix, const string& Str)
     {
-        // Name
-        string ObjHandle;
-        size_t Index = Handle.find('/');
-        if (Index != string::npos)
-        {
-            ObjHandle = Handle.substr(0, Index);
-            Handle = Handle.substr(Index + 1);
-        }
-        else
-        {
-            ObjHandle = Handle;
-            Handle.clear();
-        }
-        // Alias
-        if (ObjHandle.front() == '@' && ObjHandle.back() != '*')
-        {
-            Handle = Aliases[ObjHandle.substr(1)] + "/" + Handle;
-            ObjHandle = ExtractObjHandle(Handle);
-        }
-        return ObjHandle;
+        return Str.compare(0, Prefix.size(), Prefix) == 0;
     }
 
-    ObjectHolder_t* GetHolder(const string& Handle)
-    {
-        return (ObjectHolder_t*)(Holder::Read(Handle));
-    }
+    string ExtractObjHandle(string& Handle);
+    ObjectHolder_t* GetHolder(const string& Handle);
+    ObjectHolder_t* GetHolder(uint32_t Node);
+    Object** ReadChild(const string& Segment);
+    Object** ReadPointer(uint32_t Node);
 
-    map<string, string> Aliases;
+    static uint32_t Intern(const string& Handle);
+    static uint32_t Resolve(uint32_t Node);
+
+    map<string, Object*>* pChildren;
+
+    static deque<HandleNode> Nodes;
+    static unordered_map<string, uint32_t> NodeIds;
+    static map<string, string> Aliases;
+    static uint32_t AliasGeneration;
 };
 
 class Window;
+class GLTexture;
+class Playable;
 struct Object : ObjectHolder_t
 {
-    Object() : Lock(false)
+    /*
+     * Classes an object is an instance of. Each constructor adds its own
+     * bit (the class's TYPE), so that ObjectCast can check the type with a
+     * single test instead of a dynamic_cast.
+     * */
+    enum : uint16_t
+    {
+        TYPE_GLTEXTURE = 1 << 0,
+        TYPE_TEXTURE = 1 << 1,
+        TYPE_TEXT = 1 << 2,
+        TYPE_PLAYABLE = 1 << 3,
+        TYPE_IMAGE = 1 << 4,
+        TYPE_CHOICE = 1 << 5,
+        TYPE_SCROLLBAR = 1 << 6,
+        TYPE_CONTEXT = 1 << 7
+    };
+
+    Object() : Lock(false), Types(0), Serial(++NextSerial), pGLTexture(nullptr), pPlayable(nullptr)
     {
     }
     virtual ~Object()
@@ -161,8 +191,43 @@ struct Object : ObjectHolder_t
     {
         return false;
     }
+    // Wakes threads waiting for Action. Can be called from any thread.
+    void Signal();
     bool Lock;
+    uint16_t Types;
+    /*
+     * Unique for the lifetime of the process, unlike the address, which
+     * may be reused after Delete. Signals and waiters are matched on it.
+     * */
+    const uint32_t Serial;
+    // Object is a virtual base of these, so downcasts start from them
+    GLTexture* pGLTexture;
+    Playable* pPlayable;
     static Window* pWindow;
+    static atomic<uint32_t> NextSerial;
 };
 
+template <class T> T* ObjectCast(Object* pObject, GLTexture*)
+{
+    return static_cast<T*>(pObject->pGLTexture);
+}
+
+template <class T> T* ObjectCast(Object* pObject, Playable*)
+{
+    return static_cast<T*>(pObject->pPlayable);
+}
+
+template <class T> T* ObjectCast(Object* pObject, Object*)
+{
+    return static_cast<T*>(pObject);
+}
+
+// Returns nullptr unless pObject is a T
+template <class T> T* ObjectCast(Object* pObject)
+{
+    if (!pObject || !(pObject->Types & T::TYPE))
+        return nullptr;
+    return ObjectCast<T>(pObject, (T*)nullptr);
+}
+
 #endif
@@ -35,6 +35,8 @@ class Playable : virtual public Object
 {
     friend void LinkPad(GstElement* DecodeBin, GstPad* SourcePad, gpointer Data);
 public:
+    static const uint16_t TYPE = TYPE_PLAYABLE;
+
     Playable(const string& FileName);
     Playable(Resource Res);
     virtual ~Playable();
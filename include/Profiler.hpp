@@ -0,0 +1,74 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+using namespace std;
+
+class Bytecode;
+class NSBContext;
+
+/*
+ * Opt-in interpreter profiler, controlled from the debugger. It counts the
+ * calls and time of every builtin, and samples the call stack of the
+ * running thread every Interval microseconds. Samples are written as
+ * folded stacks ("thread;script:function;...;script:line count"), which
+ * is the input format of flamegraph.pl.
+ * */
+class Profiler
+{
+    struct BuiltinStats
+    {
+        uint64_t Calls;
+        uint64_t Time;
+    };
+public:
+    Profiler();
+
+    void Start(uint64_t Interval);
+    void Stop();
+    bool IsRunning() { return Running; }
+    bool IsSampleDue(uint64_t Now) { return Now >= NextSample; }
+    void Sample(NSBContext* pThread, uint64_t Now);
+    void Record(uint16_t Magic, uint64_t Time);
+    void WriteReport(ostream& Stream);
+    void WriteFolded(ostream& Stream);
+
+private:
+    const string& GetFunction(Bytecode* pCode, uint32_t CodeLine);
+
+    atomic<bool> Running;
+    uint64_t Interval;
+    uint64_t NextSample;
+    uint64_t NumSamples;
+    mutex Lock;
+    vector<BuiltinStats> Builtins;
+    unordered_map<string, uint64_t> Folded;
+    // Interned name of the function each line belongs to
+    unordered_map<Bytecode*, vector<uint32_t>> Functions;
+    vector<pair<Bytecode*, uint32_t>> Frames;
+};
+
+#endif
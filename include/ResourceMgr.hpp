@@ -20,11 +20,18 @@
 
 #include <vector>
 #include <map>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <cctype>
 #include <algorithm>
+#include <mutex>
 #include "inpafile.hpp"
 using namespace std;
 
 class ScriptFile;
+class Bytecode;
 
 template <class T>
 struct Holder
@@ -67,17 +74,47 @@ struct Holder
 class Resource
 {
 public:
+    Resource() : pArchive(nullptr) { }
     Resource(INpaFile* pArchive, INpaFile::NpaIterator File) : pArchive(pArchive), File(File) { }
 
     bool IsValid() { return pArchive != nullptr; }
     uint32_t GetSize() { return pArchive->GetFileSize(File); }
     char* ReadData(uint32_t Offset, uint32_t Size);
+    char* ReadFile(uint32_t& Size);
 
 private:
     INpaFile* pArchive;
     INpaFile::NpaIterator File;
 };
 
+/*
+ * Case insensitive hashing so that lookups into the resource index
+ * do not need a lowercased copy of the requested path.
+ * */
+struct CaseFoldHash
+{
+    size_t operator()(const string& Path) const
+    {
+        size_t Hash = 2166136261u;
+        for (char c : Path)
+            Hash = (Hash ^ (uint8_t)tolower((unsigned char)c)) * 16777619u;
+        return Hash;
+    }
+};
+
+struct CaseFoldEqual
+{
+    bool operator()(const string& Left, const string& Right) const
+    {
+        if (Left.size() != Right.size())
+            return false;
+        for (size_t i = 0; i < Left.size(); ++i)
+            if (tolower((unsigned char)Left[i]) != tolower((unsigned char)Right[i]))
+                return false;
+        return true;
+    }
+};
+
 class ResourceMgr
 {
 public:
@@ -87,12 +124,45 @@ public:
     virtual Resource GetResource(string Path);
     virtual char* Read(string Path, uint32_t& Size);
     ScriptFile* GetScriptFile(const string& Path);
-    ScriptFile* ResolveSymbol(const string& Symbol, uint32_t& CodeLine);
+    Bytecode* GetBytecode(ScriptFile* pScript);
+    ScriptFile* ResolveSymbol(ScriptFile* pCaller, const string& Symbol, uint32_t& CodeLine);
+    uint32_t GetGeneration() { return Generation; }
 
 protected:
     virtual ScriptFile* ReadScriptFile(const string& Path) = 0;
+    void IndexSymbols(ScriptFile* pScript);
+    void IndexArchives();
+
     Holder<ScriptFile> CacheHolder;
+    map<ScriptFile*, Bytecode*> Bytecodes;
+    uint32_t Generation;
+
+    /*
+     * Function symbols of every cached script, first loaded wins, and
+     * for each caller the includes its lookups have not read yet.
+     */
+    struct IncludeWalk
+    {
+        void Enqueue(ScriptFile* pScript);
+
+        deque<string> Pending;
+        set<string> Seen;
+    };
+    unordered_map<string, pair<ScriptFile*, uint32_t>> Symbols;
+    unordered_map<ScriptFile*, IncludeWalk> Walks;
     vector<INpaFile*> Archives;
+
+    /*
+     * Every file of every archive, keyed by its case folded path. Earlier
+     * archives take priority, same as probing them in order. Rebuilt when
+     * archives are mounted. A miss is a single probe of Index as well;
+     * ReportedMisses only keeps Read from logging the same path twice.
+     * Both are guarded by IndexLock as the ImagePool also reads.
+     * */
+    unordered_map<string, Resource, CaseFoldHash, CaseFoldEqual> Index;
+    unordered_set<string, CaseFoldHash, CaseFoldEqual> ReportedMisses;
+    size_t IndexedArchives;
+    mutex IndexLock;
 };
 
 extern ResourceMgr* sResourceMgr;
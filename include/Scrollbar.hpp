@@ -24,6 +24,8 @@ class Texture;
 class Scrollbar : public Object
 {
 public:
+    static const uint16_t TYPE = TYPE_SCROLLBAR;
+
     Scrollbar(Texture* pTexture, int32_t X1, int32_t Y1, int32_t X2, int32_t Y2, int32_t Min, int32_t Max, string Type, string Callback);
     ~Scrollbar();
 
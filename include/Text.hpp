@@ -25,6 +25,8 @@ class Playable;
 class Text : public Texture, private TextParser::Text
 {
 public:
+    static const uint16_t TYPE = TYPE_TEXT;
+
     Text();
     ~Text();
 
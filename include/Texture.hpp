@@ -31,6 +31,8 @@ class Tone;
 class Texture : public GLTexture
 {
 public:
+    static const uint16_t TYPE = TYPE_TEXTURE;
+
     Texture();
     virtual ~Texture();
 
@@ -43,6 +45,8 @@ public:
     void SetVertex(int X, int Y);
     void UpdateEffects(uint32_t Diff);
     virtual void Draw(uint32_t Diff);
+    virtual bool IsAnimating();
+    virtual bool Action();
     void SetPriority(int Priority);
     void Move(int X, int Y, int32_t Time = 0, int32_t Tempo = -1);
     void Zoom(int32_t Time, int X, int Y, int32_t Tempo);
@@ -82,6 +86,7 @@ private:
     int XScale, YScale;
     int XShake, YShake, ShakeTime;
     bool ShakeTick;
+    bool Animating;
 };
 
 #endif
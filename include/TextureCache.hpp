@@ -0,0 +1,62 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include "GLTexture.hpp"
+#include <list>
+#include <map>
+#include <tuple>
+
+/*
+ * Textures loaded from files, keyed by path, mask flag and clip
+ * rectangle. An entry is shared by every GLTexture which shows it. Once
+ * the last of them lets go, the cache takes ownership back and keeps it
+ * in the Released list, so that transitions and button states which come
+ * back are not decoded and uploaded again. Released textures are evicted
+ * least recently released first to stay within a budget of texture memory.
+ * */
+class TextureCache
+{
+public:
+    static TextureRef Get(const string& Filename, bool Mask, int ClipX, int ClipY, int ClipWidth, int ClipHeight);
+    static void Clear();
+
+private:
+    typedef tuple<string, bool, int, int, int, int> Key;
+    static const size_t RETAIN_BYTES = 256 * 1024 * 1024;
+
+    static TextureRef Adopt(const Key& CacheKey, TextureData* pData);
+    static void Release(const Key& CacheKey, TextureData* pData);
+    static void Trim();
+
+    typedef list<pair<Key, unique_ptr<TextureData>>> ReleasedList;
+
+    struct Entry
+    {
+        // Shown by some GLTexture, otherwise the entry is in Released
+        weak_ptr<TextureData> pData;
+        ReleasedList::iterator Released;
+    };
+
+    static map<Key, Entry> Entries;
+    static ReleasedList Released;
+    static size_t ReleasedBytes;
+};
+
+#endif
@@ -0,0 +1,68 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+using namespace std;
+
+/*
+ * Opt-in timeline tracer which writes Chrome trace events (chrome://tracing,
+ * Perfetto). Every thread records into its own ring buffer of its latest
+ * events, which only it writes to, so recording takes no locks. Buffers are written out
+ * by Flush, at exit or from the debugger. While disabled, a trace point
+ * costs one relaxed atomic load.
+ * */
+class Tracer
+{
+public:
+    static void Start(const string& Filename);
+    static void Stop();
+    static void Flush();
+    static bool IsEnabled() { return Enabled.load(memory_order_relaxed); }
+    static uint64_t GetTime();
+    static void Add(const char* pName, const char* pCategory, uint64_t Begin, uint64_t Duration);
+
+private:
+    static atomic<bool> Enabled;
+};
+
+// Records the lifetime of the scope as one event
+class TraceScope
+{
+public:
+    TraceScope(const char* pName, const char* pCategory) :
+    pName(pName), pCategory(pCategory), Begin(Tracer::IsEnabled() ? Tracer::GetTime() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (Begin)
+            Tracer::Add(pName, pCategory, Begin, Tracer::GetTime() - Begin);
+    }
+
+private:
+    const char* pName;
+    const char* pCategory;
+    uint64_t Begin;
+};
+
+#endif
@@ -22,12 +22,25 @@
 #include <string>
 #include <functional>
 #include <map>
+#include <vector>
 using namespace std;
 
+/*
+ * Variables are kept small since arrays and the parameter stack hold
+ * thousands of them: the value is a tagged 24 byte record with short
+ * strings stored inline, the name is an interned id (see: Bytecode::Intern)
+ * and array state only exists for variables which are used as arrays.
+ * Strings which came from a literal remember its id, so that the constants
+ * resolved at load time (see: Bytecode::GetConstants) can be found.
+ * With the name, literal id and array pointer a Variable is 40 bytes.
+ * Named variables, array elements and stack temporaries are all passed
+ * around as Variable*, so they share this layout.
+ * */
 class Variable
 {
+    friend class Stack;
 protected:
-    enum
+    enum : uint8_t
     {
         NSB_NULL = 0,
         NSB_INT = 1,
@@ -36,49 +49,96 @@ protected:
         NSB_BOOL = 4
     } Tag;
 
-    struct
-    {
-        int32_t Int;
-        float Float;
-        string Str;
-        bool Bool;
-    } Val;
-
     Variable();
 
     void Initialize();
     void Initialize(Variable* pVar);
 
 public:
-    virtual ~Variable();
+    Variable(const Variable&) = delete;
+    Variable& operator=(const Variable&) = delete;
+    ~Variable();
 
     static Variable* MakeNull(const string& Name);
-    static Variable* MakeFloat(float Float);
-    static Variable* MakeInt(int32_t Int);
-    static Variable* MakeString(const string& Str);
     static Variable* MakeCopy(Variable* pVar, const string& Name);
 
     int GetTag();
     float ToFloat();
     int32_t ToInt();
     string ToString();
+    bool ToBool();
     bool IsFloat();
-    bool IsInt();
-    bool IsString();
+    bool IsInt() { return Tag == NSB_INT || Tag == NSB_NULL || Relative || BoolValue != -1; }
+    bool IsString() { return Tag == NSB_STRING || Tag == NSB_NULL || Relative; }
     bool IsNull();
     void Set(Variable* pVar);
     void Set(float Float);
     void Set(int32_t Int);
     void Set(const string& Str);
+    void SetLiteral(uint32_t Id);
+    uint32_t GetStringId() { return StrId; }
     Variable* IntUnaryOp(function<int32_t(int32_t)> Func);
+    Variable* GetElement(int32_t Index);
+    Variable* ReadElement(int32_t Index);
+    int32_t GetNumElements() { return pArray ? pArray->NumElements : 0; }
+    const vector<Variable*>& GetElements();
+    map<string, int>& GetAssoc();
+    bool HasAssoc() { return pArray && !pArray->Assoc.empty(); }
+    const string& GetName();
 
-    static Variable* Add(Variable* pFirst, Variable* pSecond);
-    static void Destroy(Variable* pVar);
+    static void Add(Variable* pFirst, Variable* pSecond, Variable* pResult);
 
-    bool Literal;
     bool Relative;
-    map<string, int> Assoc;
-    string Name;
+
+    static const uint32_t NO_STRING = UINT32_MAX;
+    // Heap buffers allocated for strings too long to be stored inline
+    static uint64_t NumStringAllocs;
+
+private:
+    /*
+     * Array elements, named Name/Index. Slots are created on first access,
+     * so NumElements counts only the elements which exist.
+     * */
+    struct ArrayData
+    {
+        vector<Variable*> Elements;
+        int32_t NumElements;
+        map<string, int> Assoc;
+    };
+
+    ArrayData* GetArray();
+    void ClearArray();
+    void SetString(const char* pData, uint32_t Size);
+    void ClearString();
+    const char* GetData() { return StrSize == HEAP_STRING ? Heap.pData : Inline; }
+    uint32_t GetSize() { return StrSize == HEAP_STRING ? Heap.Size : StrSize; }
+
+    static const uint8_t HEAP_STRING = 0xFF;
+    static const uint32_t INLINE_CAPACITY = 16;
+
+    // Boolean constant value of the string (see: Nsb::Boolean), or -1
+    int8_t BoolValue;
+    // Length of the inline string, or HEAP_STRING
+    uint8_t StrSize;
+    union
+    {
+        int32_t Int;
+        float Float;
+    } Val;
+    union
+    {
+        char Inline[INLINE_CAPACITY];
+        struct
+        {
+            char* pData;
+            uint32_t Size;
+        } Heap;
+    };
+
+    uint32_t NameId;
+    // Interned id of the string if it came from a literal, or NO_STRING
+    uint32_t StrId;
+    ArrayData* pArray;
 };
 
 #endif
@@ -24,6 +24,7 @@
 using namespace std;
 
 class Texture;
+struct Object;
 class NSBInterpreter;
 class Window
 {
@@ -32,6 +33,7 @@ public:
     virtual ~Window();
 
     static void PushMoveCursorEvent(int X, int Y);
+    static void PushSignalEvent(uint32_t Serial);
 
     void Run();
     void Exit();
@@ -41,6 +43,7 @@ public:
     void MoveCursor(int32_t X, int32_t Y);
     bool IsRunning_() { return IsRunning; }
     void SetFullscreen(Uint32 flags);
+    void SetFrameRate(uint32_t Rate);
     void DrawTextures(uint32_t Diff);
 
     const int WIDTH;
@@ -51,8 +54,14 @@ protected:
     NSBInterpreter* pInterpreter;
 private:
     void Draw();
+    void Tick();
+    bool IsAnimating();
+    static uint64_t GetTime();
+    uint64_t GetScriptBudget();
 
-    uint32_t LastDrawTime;
+    uint64_t LastDrawTime;
+    uint64_t LastTickTime;
+    uint64_t FrameTime;
     bool IsRunning;
     bool EventLoop;
     SDL_Window* SDLWindow;
@@ -0,0 +1,379 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Bytecode.hpp"
+#include "ResourceMgr.hpp"
+#include "scriptfile.hpp"
+#include "nsbmagic.hpp"
+#include "nsbconstants.hpp"
+#include <boost/algorithm/string.hpp>
+#include <cstdlib>
+#include <climits>
+
+deque<string> Bytecode::Strings;
+unordered_map<string, uint32_t> Bytecode::StringIds;
+deque<StringConstants> Bytecode::Constants;
+
+Bytecode::Bytecode(ScriptFile* pScript) : pScript(pScript)
+{
+    for (uint32_t i = 0; ; ++i)
+    {
+        Line* pLine = pScript->GetLine(i);
+        if (!pLine && i != 0)
+            break;
+
+        Code.push_back({0, 0, (uint32_t)Operands.size(), Instruction::SUPER_NONE, 1, 0});
+        if (pLine)
+            Decode(&Code.back(), pLine);
+    }
+    Optimize();
+}
+
+void Bytecode::Decode(Instruction* pInst, Line* pLine)
+{
+    pInst->Magic = pLine->Magic;
+    pInst->NumParams = pLine->Params.size();
+    for (const string& Param : pLine->Params)
+    {
+        Operand Op;
+        Op.Str = Intern(Param);
+        Op.Type = Operand::STRING;
+        Op.Int = 0;
+        Operands.push_back(Op);
+    }
+
+    Operand* pParams = &Operands[pInst->Params];
+    if (pInst->Magic == MAGIC_LITERAL && pInst->NumParams == 2)
+    {
+        const string& Type = pLine->Params[0];
+        const string& Val = pLine->Params[1];
+        if (Type == "INT")
+        {
+            pParams[1].Type = Operand::INT;
+            pParams[1].Int = strtol(Val.c_str(), nullptr, 10);
+        }
+        else if (Type == "FLOAT")
+        {
+            pParams[1].Type = Operand::FLOAT;
+            pParams[1].Float = strtof(Val.c_str(), nullptr);
+        }
+        else if (Type == "STRING")
+            ResolveConstants(pParams[1].Str);
+        else
+            pParams[1].Type = Operand::NONE;
+    }
+    else if (pInst->Magic == MAGIC_SUB_SCRIPT && pInst->NumParams == 2)
+    {
+        pParams[1].Type = Operand::INT;
+        pParams[1].Int = strtol(pLine->Params[1].c_str(), nullptr, 10);
+    }
+    else if ((pInst->Magic == MAGIC_IF || pInst->Magic == MAGIC_WHILE ||
+              pInst->Magic == MAGIC_JUMP || pInst->Magic == MAGIC_SELECT) && pInst->NumParams >= 1)
+    {
+        DecodeLabel(pParams[0], pLine->Params[0]);
+    }
+    else if (pInst->Magic == MAGIC_CASE && pInst->NumParams >= 3)
+    {
+        DecodeLabel(pParams[1], pLine->Params[1]);
+        DecodeLabel(pParams[2], pLine->Params[2]);
+    }
+    else if (pInst->Magic == MAGIC_CALL_FUNCTION && pInst->NumParams >= 1)
+    {
+        pParams[0].Type = Operand::CALL;
+        pParams[0].Int = Calls.size();
+        Calls.push_back({Intern("function." + pLine->Params[0]), 0, nullptr, NSB_INVALIDE_LINE});
+    }
+}
+
+void Bytecode::DecodeLabel(Operand& Op, const string& Label)
+{
+    Op.Type = Operand::LABEL;
+    Op.Int = pScript->GetSymbol(Label);
+}
+
+CallTarget& Bytecode::ResolveCall(const Operand& Op)
+{
+    CallTarget& Target = Calls[Op.Int];
+    // Symbols never move once loaded, only misses may resolve later
+    if (Target.pCode || Target.Generation == sResourceMgr->GetGeneration())
+        return Target;
+
+    const string& Symbol = GetString(Target.Symbol);
+    ScriptFile* pTarget = pScript;
+    Target.CodeLine = pScript->GetSymbol(Symbol);
+    if (Target.CodeLine == NSB_INVALIDE_LINE)
+        pTarget = sResourceMgr->ResolveSymbol(pScript, Symbol, Target.CodeLine);
+
+    Target.pCode = pTarget ? sResourceMgr->GetBytecode(pTarget) : nullptr;
+    Target.Generation = sResourceMgr->GetGeneration();
+    return Target;
+}
+
+uint32_t Bytecode::Intern(const string& Str)
+{
+    auto iter = StringIds.find(Str);
+    if (iter != StringIds.end())
+        return iter->second;
+
+    uint32_t Id = Strings.size();
+    Strings.push_back(Str);
+    StringIds[Str] = Id;
+    return Id;
+}
+
+void Bytecode::ResolveConstants(uint32_t Id)
+{
+    if (Id < Constants.size() && Constants[Id].Resolved)
+        return;
+
+    if (Id >= Constants.size())
+        Constants.resize(Id + 1, {false, 0, 0, 0, 0, 0, 0});
+
+    const string& Str = Strings[Id];
+    StringConstants& Consts = Constants[Id];
+    Consts.Resolved = true;
+    Consts.Tempo = Nsb::ConstantToValue<Nsb::Tempo>(Str);
+    Consts.Request = Nsb::ConstantToValue<Nsb::Request>(Str);
+    Consts.Tone = Nsb::ConstantToValue<Nsb::Tone>(Str);
+    Consts.Effect = Nsb::ConstantToValue<Nsb::Effect>(Str);
+    Consts.Shade = Nsb::ConstantToValue<Nsb::Shade>(Str);
+    Consts.Color = ParseColor(Str);
+}
+
+// Returns nullptr if Id is not a decoded string literal
+const StringConstants* Bytecode::GetConstants(uint32_t Id)
+{
+    if (Id >= Constants.size() || !Constants[Id].Resolved)
+        return nullptr;
+    return &Constants[Id];
+}
+
+// Color name or the first six hex digits of Str
+uint32_t Bytecode::ParseColor(const string& Str)
+{
+    string Lower = boost::algorithm::to_lower_copy(Str);
+    if (Nsb::IsValidConstant<Nsb::Color>(Lower))
+        return Nsb::ConstantToValue<Nsb::Color>(Lower);
+
+    size_t i = Lower.find_first_of("0123456789abcdef");
+    if (i != Lower.npos && Lower.size() - i >= 6)
+        return stoi(Lower.substr(i, 6), nullptr, 16) | (0xFF << 24);
+    return 0;
+}
+
+static Operand MakeInt(int32_t Value)
+{
+    Operand Op;
+    Op.Str = 0;
+    Op.Type = Operand::INT;
+    Op.Int = Value;
+    return Op;
+}
+
+/*
+ * Constant operands of the arithmetic and comparison builtins are computed
+ * with the same integer semantics the interpreter would use at runtime.
+ * */
+static bool FoldInt(uint16_t Magic, int32_t Lhs, int32_t Rhs, int32_t& Result)
+{
+    switch (Magic)
+    {
+        case MAGIC_ADD_EXPRESSION: Result = uint32_t(Lhs) + uint32_t(Rhs); return true;
+        case MAGIC_SUB_EXPRESSION: Result = uint32_t(Lhs) - uint32_t(Rhs); return true;
+        case MAGIC_MUL_EXPRESSION: Result = uint32_t(Lhs) * uint32_t(Rhs); return true;
+        case MAGIC_DIV_EXPRESSION:
+        case MAGIC_MOD_EXPRESSION:
+            if (Rhs == 0 || (Lhs == INT_MIN && Rhs == -1))
+                return false;
+            Result = Magic == MAGIC_DIV_EXPRESSION ? Lhs / Rhs : Lhs % Rhs;
+            return true;
+        case MAGIC_CMP_EQUAL: Result = Lhs == Rhs; return true;
+        case MAGIC_CMP_NE: Result = Lhs != Rhs; return true;
+        case MAGIC_CMP_LESS: Result = Lhs < Rhs; return true;
+        case MAGIC_CMP_GREATER: Result = Lhs > Rhs; return true;
+        case MAGIC_CMP_LE: Result = Lhs <= Rhs; return true;
+        case MAGIC_CMP_GE: Result = Lhs >= Rhs; return true;
+        case MAGIC_CMP_LOGICAL_AND: Result = Lhs && Rhs; return true;
+        case MAGIC_CMP_LOGICAL_OR: Result = Lhs || Rhs; return true;
+    }
+    return false;
+}
+
+static bool IsCompare(uint16_t Magic)
+{
+    return Magic == MAGIC_CMP_EQUAL || Magic == MAGIC_CMP_NE ||
+           Magic == MAGIC_CMP_LESS || Magic == MAGIC_CMP_GREATER ||
+           Magic == MAGIC_CMP_LE || Magic == MAGIC_CMP_GE;
+}
+
+/*
+ * Peephole pass. Superinstructions never span a statement boundary
+ * (MAGIC_CLEAR_PARAMS) and never cover a line that control can enter from
+ * elsewhere: label targets, declarations and return addresses.
+ * */
+void Bytecode::Optimize()
+{
+    vector<bool> Targets(Code.size() + 1, false);
+    for (uint32_t i = 0; i < Code.size(); ++i)
+    {
+        Instruction* pInst = &Code[i];
+        for (uint32_t j = 0; j < pInst->NumParams; ++j)
+        {
+            const Operand& Op = GetOperand(pInst, j);
+            if (Op.Type == Operand::LABEL && uint32_t(Op.Int) < Targets.size())
+                Targets[Op.Int] = true;
+        }
+
+        switch (pInst->Magic)
+        {
+            case MAGIC_FUNCTION_DECLARATION:
+                Targets[i] = true;
+                break;
+            case MAGIC_CALL_FUNCTION:
+            case MAGIC_CALL_SCENE:
+            case MAGIC_CALL_CHAPTER:
+                Targets[i + 1] = true;
+                break;
+        }
+    }
+
+    FoldConstants(Targets);
+
+    static const uint32_t ArrayVariable = Intern("__array_variable__");
+    Operand Lhs, Rhs;
+    for (uint32_t i = 0; i < Code.size(); i += Code[i].Length)
+    {
+        if (Code[i].Super != Instruction::SUPER_NONE)
+            continue;
+
+        if (GetSource(i, Lhs) && GetSource(i + 1, Rhs))
+        {
+            Instruction* pThird = i + 2 < Code.size() ? &Code[i + 2] : nullptr;
+            Instruction* pFourth = i + 3 < Code.size() ? &Code[i + 3] : nullptr;
+            if (!pThird || !pFourth || pFourth->NumParams == 0 || !CanFuse(Targets, i, 4))
+                continue;
+
+            if (IsCompare(pThird->Magic) && (pFourth->Magic == MAGIC_IF || pFourth->Magic == MAGIC_WHILE))
+                Fuse(i, Instruction::SUPER_CMP_BRANCH, 4, {Lhs, Rhs, MakeInt(pThird->Magic),
+                     GetOperand(pFourth, 0), MakeInt(pFourth->Magic)});
+            else if (pThird->Magic == MAGIC_ADD_EXPRESSION && pFourth->Magic == MAGIC_ASSIGN &&
+                     GetOperand(pFourth, 0).Str != ArrayVariable)
+                Fuse(i, Instruction::SUPER_ADD_ASSIGN, 4, {Lhs, Rhs, GetOperand(pFourth, 0)});
+        }
+        else if (GetSource(i, Lhs) && Lhs.Type != Operand::INT && Lhs.Type != Operand::FLOAT &&
+                 (IsMagic(i + 1, MAGIC_INCREMENT) || IsMagic(i + 1, MAGIC_DECREMENT)) &&
+                 CanFuse(Targets, i, 2))
+            Fuse(i, Instruction::SUPER_INCREMENT, 2, {Lhs, MakeInt(Code[i + 1].Magic)});
+    }
+}
+
+/*
+ * Folds trees of integer literals bottom-up. Scanning backwards means the
+ * right operand of an expression is already folded when its left operand
+ * is visited, and a folded left operand is extended in place.
+ * */
+void Bytecode::FoldConstants(const vector<bool>& Targets)
+{
+    for (uint32_t i = Code.size(); i-- > 0;)
+    {
+        int32_t Lhs, Rhs, Result;
+        uint32_t LhsLength, RhsLength;
+        while (GetConstant(i, Lhs, LhsLength) && GetConstant(i + LhsLength, Rhs, RhsLength))
+        {
+            uint32_t Op = i + LhsLength + RhsLength;
+            if (Op >= Code.size() || !CanFuse(Targets, i, Op - i + 1) ||
+                !FoldInt(Code[Op].Magic, Lhs, Rhs, Result))
+                break;
+
+            Fuse(i, Instruction::SUPER_PUSH_INT, Op - i + 1, {MakeInt(Result)});
+        }
+    }
+}
+
+bool Bytecode::GetConstant(uint32_t Index, int32_t& Value, uint32_t& Length)
+{
+    if (Index >= Code.size())
+        return false;
+
+    Instruction* pInst = &Code[Index];
+    if (pInst->Super == Instruction::SUPER_PUSH_INT)
+    {
+        Value = GetSuperOperand(pInst, 0).Int;
+        Length = pInst->Length;
+        return true;
+    }
+
+    Operand Op;
+    if (!GetSource(Index, Op) || Op.Type != Operand::INT)
+        return false;
+
+    Value = Op.Int;
+    Length = 1;
+    return true;
+}
+
+/*
+ * Instructions which push a single value without side effects other than
+ * creating a missing variable: MAGIC_LITERAL and MAGIC_VARIABLE.
+ * */
+bool Bytecode::GetSource(uint32_t Index, Operand& Op)
+{
+    if (Index >= Code.size())
+        return false;
+
+    Instruction* pInst = &Code[Index];
+    if (pInst->Super != Instruction::SUPER_NONE)
+        return false;
+
+    if (pInst->Magic == MAGIC_LITERAL && pInst->NumParams == 2)
+    {
+        Op = GetOperand(pInst, 1);
+        return Op.Type == Operand::INT || Op.Type == Operand::FLOAT || Op.Type == Operand::STRING;
+    }
+    if (pInst->Magic == MAGIC_VARIABLE && pInst->NumParams >= 1)
+    {
+        Op = GetOperand(pInst, 0);
+        Op.Type = Operand::VARIABLE;
+        return true;
+    }
+    return false;
+}
+
+bool Bytecode::IsMagic(uint32_t Index, uint16_t Magic)
+{
+    return Index < Code.size() && Code[Index].Magic == Magic;
+}
+
+bool Bytecode::CanFuse(const vector<bool>& Targets, uint32_t Begin, uint32_t Length)
+{
+    if (Begin + Length > Code.size())
+        return false;
+
+    for (uint32_t i = Begin; i < Begin + Length; ++i)
+        if ((i != Begin && Targets[i]) || Code[i].Magic == MAGIC_CLEAR_PARAMS)
+            return false;
+    return true;
+}
+
+void Bytecode::Fuse(uint32_t Index, uint16_t Super, uint16_t Length, const vector<Operand>& Ops)
+{
+    Instruction* pInst = &Code[Index];
+    pInst->Super = Super;
+    pInst->Length = Length;
+    pInst->SuperParams = Operands.size();
+    Operands.insert(Operands.end(), Ops.begin(), Ops.end());
+}
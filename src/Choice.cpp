@@ -20,6 +20,7 @@
 
 Choice::Choice() : MouseOver(false), ButtonDown(false), ButtonUp(false)
 {
+    Types |= TYPE;
     Write("MouseUsual", new Name);
     Write("MouseOver", new Name);
     Write("MouseClick", new Name);
@@ -38,9 +39,9 @@ bool Choice::IsSelected(const SDL_Event& Event)
         case SDL_KEYDOWN: Arrow(Event.key.keysym.sym); break;
     }
 
-    Texture* pMouseOver = dynamic_cast<Texture*>(Read("MouseOver/img"));
-    Texture* pMouseClick = dynamic_cast<Texture*>(Read("MouseClick/img"));
-    Texture* pMouseUsual = dynamic_cast<Texture*>(Read("MouseUsual/img"));
+    Texture* pMouseOver = ObjectCast<Texture>(Read("MouseOver/img"));
+    Texture* pMouseClick = ObjectCast<Texture>(Read("MouseClick/img"));
+    Texture* pMouseUsual = ObjectCast<Texture>(Read("MouseUsual/img"));
 
     if (pMouseOver) pMouseOver->Fade(0, 0);
     if (pMouseClick) pMouseClick->Fade(0, 0);
@@ -60,7 +61,7 @@ void Choice::SetNextFocus(Choice* pNext, const string& Key)
 
 void Choice::Cursor(int x, int y, bool& Flag)
 {
-    Texture* pTexture = dynamic_cast<Texture*>(Read("MouseUsual/img"));
+    Texture* pTexture = ObjectCast<Texture>(Read("MouseUsual/img"));
     if (!pTexture) return;
     int x1 = pTexture->GetX();
     int x2 = x1 + pTexture->GetWidth();
@@ -91,7 +92,7 @@ void Choice::Arrow(SDL_Keycode sym)
 void Choice::ChangeFocus(int Index)
 {
     if (Choice* pChoice = pNextFocus[Index])
-        if (Texture* pTexture = dynamic_cast<Texture*>(pChoice->Read("MouseOver/img")))
+        if (Texture* pTexture = ObjectCast<Texture>(pChoice->Read("MouseOver/img")))
             Window::PushMoveCursorEvent(pTexture->GetX() + pTexture->GetWidth() / 2, pTexture->GetY() + pTexture->GetHeight() / 2);
 }
 
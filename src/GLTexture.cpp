@@ -15,8 +15,11 @@
  * You should have received a copy of the GNU Lesser Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
+#include <GL/glew.h>
 #include "GLTexture.hpp"
+#include "TextureCache.hpp"
 #include "Image.hpp"
+#include "Tracer.hpp"
 #include <cstring>
 
 size_t GLFormatToVals(GLenum Format)
@@ -35,21 +38,75 @@ size_t GLFormatToVals(GLenum Format)
     assert(false);
 }
 
+static uint8_t* ClipPixels(Image* pImage, int ClipX, int ClipY, int ClipWidth, int ClipHeight)
+{
+    size_t NumVals = GLFormatToVals(pImage->GetFormat());
+    uint8_t* pClipped = new uint8_t[ClipWidth * ClipHeight * NumVals];
+    for (int i = 0; i < ClipHeight; ++i)
+        memcpy(pClipped + i * ClipWidth * NumVals, pImage->GetPixels() + (pImage->GetWidth() * (ClipY + i) + ClipX) * NumVals, ClipWidth * NumVals);
+    return pClipped;
+}
+
+TextureData::TextureData() :
+Width(0), Height(0),
+Cached(false),
+ClipX(-1), ClipY(-1)
+{
+    glGenTextures(1, &ID);
+}
+
+TextureData::~TextureData()
+{
+    glDeleteTextures(1, &ID);
+}
+
+void TextureData::Upload(uint8_t* Pixels, GLenum Format)
+{
+    TraceScope Trace("Upload", "texture");
+    glBindTexture(GL_TEXTURE_2D, ID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Width, Height, 0, Format, GL_UNSIGNED_BYTE, Pixels);
+}
+
+void TextureData::Resolve()
+{
+    if (!pPending)
+        return;
+
+    shared_ptr<Image> pImage;
+    pImage.swap(pPending);
+    if (ClipX == -1)
+    {
+        Upload(pImage->GetPixels(), pImage->GetFormat());
+        return;
+    }
+
+    uint8_t* pClipped = ClipPixels(pImage.get(), ClipX, ClipY, Width, Height);
+    Upload(pClipped, pImage->GetFormat());
+    delete[] pClipped;
+}
+
 GLTexture::GLTexture() :
 Width(0), Height(0),
 GLTextureID(GL_INVALID_VALUE)
 {
+    Types |= TYPE;
+    pGLTexture = this;
 }
 
 GLTexture::~GLTexture()
 {
-    glDeleteTextures(1, &GLTextureID);
 }
 
 void GLTexture::Draw(int X, int Y, const string& Filename)
 {
     Image Img;
     Img.LoadImage(Filename);
+    Detach();
+    if (!pData)
+        return;
+
     glBindTexture(GL_TEXTURE_2D, GLTextureID);
     glTexSubImage2D(GL_TEXTURE_2D, 0, X, Y, Img.GetWidth(), Img.GetHeight(), Img.GetFormat(), GL_UNSIGNED_BYTE, Img.GetPixels());
 }
@@ -63,6 +120,7 @@ void GLTexture::Draw(float X, float Y, float Width, float Height)
 void GLTexture::Draw(const float* xa, const float* ya)
 {
     static const float x[4] = {0, 1, 1, 0}, y[4] = {0, 0, 1, 1};
+    Upload();
     glBindTexture(GL_TEXTURE_2D, GLTextureID);
     glBegin(GL_QUADS);
     for (int i = 0; i < 4; ++i)
@@ -89,9 +147,7 @@ void GLTexture::CreateFromColor(int Width, int Height, uint32_t Color)
 
 void GLTexture::CreateFromFile(const string& Filename, bool Mask)
 {
-    Image Img;
-    Img.LoadImage(Filename, Mask);
-    CreateFromImage(&Img);
+    Share(TextureCache::Get(Filename, Mask, -1, -1, 0, 0));
 }
 
 void GLTexture::CreateFromImage(Image* pImage)
@@ -101,20 +157,14 @@ void GLTexture::CreateFromImage(Image* pImage)
 
 void GLTexture::CreateFromImageClip(Image* pImage, int ClipX, int ClipY, int ClipWidth, int ClipHeight)
 {
-    size_t NumVals = GLFormatToVals(pImage->GetFormat());
-    uint8_t* pClipped = new uint8_t[ClipWidth * ClipHeight * NumVals];
-    for (int i = 0; i < ClipHeight; ++i)
-        memcpy(pClipped + i * ClipWidth * NumVals, pImage->GetPixels() + (pImage->GetWidth() * (ClipY + i) + ClipX) * NumVals, ClipWidth * NumVals);
-
+    uint8_t* pClipped = ClipPixels(pImage, ClipX, ClipY, ClipWidth, ClipHeight);
     Create(pClipped, pImage->GetFormat(), ClipWidth, ClipHeight);
     delete[] pClipped;
 }
 
 void GLTexture::CreateFromFileClip(const string& Filename, int ClipX, int ClipY, int ClipWidth, int ClipHeight)
 {
-    Image Img;
-    Img.LoadImage(Filename);
-    CreateFromImageClip(&Img, ClipX, ClipY, ClipWidth, ClipHeight);
+    Share(TextureCache::Get(Filename, false, ClipX, ClipY, ClipWidth, ClipHeight));
 }
 
 void GLTexture::CreateEmpty(int Width, int Height)
@@ -124,17 +174,61 @@ void GLTexture::CreateEmpty(int Width, int Height)
 
 void GLTexture::Create(uint8_t* Pixels, GLenum Format, int W, int H)
 {
-    Width = W;
-    Height = H;
-    glDeleteTextures(1, &GLTextureID);
-    glGenTextures(1, &GLTextureID);
-    glBindTexture(GL_TEXTURE_2D, GLTextureID);
-    SetSmoothing(false);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Width, Height, 0, Format, GL_UNSIGNED_BYTE, Pixels);
+    TextureRef pData = make_shared<TextureData>();
+    pData->Width = W;
+    pData->Height = H;
+    pData->Upload(Pixels, Format);
+    Share(pData);
 }
 
+void GLTexture::Share(TextureRef pData)
+{
+    this->pData = pData;
+    GLTextureID = pData->ID;
+    Width = pData->Width;
+    Height = pData->Height;
+}
+
+void GLTexture::Upload()
+{
+    if (pData)
+        pData->Resolve();
+}
+
+/*
+ * Cached textures are shared by unrelated objects, so they are copied
+ * before being drawn to.
+ * */
+void GLTexture::Detach()
+{
+    Upload();
+    if (!pData || !pData->Cached)
+        return;
+
+    GLuint Framebuffer;
+    glGenFramebuffers(1, &Framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, GLTextureID, 0);
+
+    TextureRef pCopy = make_shared<TextureData>();
+    pCopy->Width = Width;
+    pCopy->Height = Height;
+    pCopy->Upload(nullptr, GL_RGBA);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, Width, Height);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &Framebuffer);
+    Share(pCopy);
+}
+
+// Filtering is state of the texture, so cached ones are copied first
 void GLTexture::SetSmoothing(bool Set)
 {
+    Detach();
+    if (!pData)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, GLTextureID);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Set ? GL_LINEAR : GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Set ? GL_LINEAR : GL_NEAREST);
 }
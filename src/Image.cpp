@@ -17,14 +17,19 @@
  * */
 #include <GL/glew.h>
 #include "Image.hpp"
+#include "ImagePool.hpp"
 #include "ResourceMgr.hpp"
 #include "Window.hpp"
+#include "Tracer.hpp"
 #include <jpeglib.h>
 #include <png.h>
 #include <new>
+#include <cstring>
+#include <glib.h>
 
 Image::Image() : Format(-1), Width(0), Height(0), pPixels(0)
 {
+    Types |= TYPE;
 }
 
 Image::~Image()
@@ -46,9 +51,22 @@ void Image::LoadImage(const string& Filename, bool Mask)
 {
     uint32_t Size;
     uint8_t* pData = (uint8_t*)sResourceMgr->Read(Filename, Size);
-    if (!pData)
-        return;
+    if (pData)
+        Decode(pData, Size, Filename, Mask);
+}
 
+// Reads straight from the archive, for the ImagePool workers
+void Image::LoadImage(Resource Res, const string& Filename, bool Mask)
+{
+    uint32_t Size;
+    uint8_t* pData = (uint8_t*)Res.ReadFile(Size);
+    if (pData)
+        Decode(pData, Size, Filename, Mask);
+}
+
+// Takes ownership of pData
+void Image::Decode(uint8_t* pData, uint32_t Size, const string& Filename, bool Mask)
+{
     if (Filename.substr(Filename.size() - 3) == "jpg")
     {
         pPixels = LoadJPEG(pData, Size);
@@ -64,6 +82,85 @@ void Image::LoadImage(const string& Filename, bool Mask)
     delete[] pData;
 }
 
+// Copies Size bytes at Offset of the resource, if the file is long enough
+static bool Peek(Resource& Res, uint32_t Offset, uint8_t* pOut, uint32_t Size)
+{
+    if (Offset > Res.GetSize() || Size > Res.GetSize() - Offset)
+        return false;
+
+    char* pData = Res.ReadData(Offset, Size);
+    if (!pData)
+        return false;
+
+    memcpy(pOut, pData, Size);
+    g_free(pData);
+    return true;
+}
+
+/*
+ * Reads the dimensions from the PNG IHDR chunk or the first JPEG SOF
+ * marker, so that textures can be laid out before they are decoded.
+ * Only the headers are read: the first 24 bytes, then 9 bytes for each
+ * JPEG segment skipped on the way to the SOF marker.
+ * */
+static bool ReadSize(Resource& Res, int& Width, int& Height)
+{
+    static const uint8_t PNGMagic[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static const int MAX_SEGMENTS = 32;
+
+    uint8_t Header[24];
+    if (!Peek(Res, 0, Header, sizeof(Header)))
+        return false;
+
+    if (memcmp(Header, PNGMagic, 8) == 0)
+    {
+        Width = Header[16] << 24 | Header[17] << 16 | Header[18] << 8 | Header[19];
+        Height = Header[20] << 24 | Header[21] << 16 | Header[22] << 8 | Header[23];
+        return true;
+    }
+
+    if (Header[0] != 0xFF || Header[1] != 0xD8)
+        return false;
+
+    uint32_t i = 2;
+    uint8_t Segment[9];
+    for (int j = 0; j < MAX_SEGMENTS && Peek(Res, i, Segment, sizeof(Segment)) && Segment[0] == 0xFF; ++j)
+    {
+        uint8_t Marker = Segment[1];
+        if (Marker >= 0xC0 && Marker <= 0xCF && Marker != 0xC4 && Marker != 0xC8 && Marker != 0xCC)
+        {
+            Height = Segment[5] << 8 | Segment[6];
+            Width = Segment[7] << 8 | Segment[8];
+            return true;
+        }
+        i += 2 + (Segment[2] << 8 | Segment[3]);
+    }
+    return false;
+}
+
+void Image::LoadImageAsync(const string& Filename, bool Mask)
+{
+    // Files which are not in the archives are left to Read
+    Resource Res = sResourceMgr->GetResource(Filename);
+    if (Res.IsValid() && ReadSize(Res, Width, Height))
+        Pending = ImagePool::Decode(Res, Filename, Mask);
+    else
+        LoadImage(Filename, Mask);
+}
+
+void Image::Wait()
+{
+    if (!Pending.valid())
+        return;
+
+    shared_ptr<Image> pDecoded = Pending.get();
+    Pending = ImageFuture();
+    swap(pPixels, pDecoded->pPixels);
+    Format = pDecoded->Format;
+    Width = pDecoded->Width;
+    Height = pDecoded->Height;
+}
+
 void Image::LoadScreen(Window* pWindow)
 {
     Format = GL_BGRA;
@@ -82,6 +179,7 @@ void Image::LoadScreen(Window* pWindow)
 
 uint8_t* Image::LoadPNG(uint8_t* pMem, uint32_t Size, uint8_t Format)
 {
+    TraceScope Trace("LoadPNG", "image");
     png_image png;
     memset(&png, 0, sizeof(png_image));
     png.version = PNG_IMAGE_VERSION;
@@ -110,6 +208,7 @@ uint8_t* Image::LoadPNG(uint8_t* pMem, uint32_t Size, uint8_t Format)
 
 uint8_t* Image::LoadJPEG(uint8_t* pMem, uint32_t Size)
 {
+    TraceScope Trace("LoadJPEG", "image");
     struct jpeg_decompress_struct jpeg;
     struct jpeg_error_mgr err;
 
@@ -0,0 +1,101 @@
+/* 
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "ImagePool.hpp"
+#include <algorithm>
+
+vector<thread> ImagePool::Workers;
+deque<ImagePool::Job> ImagePool::Jobs;
+mutex ImagePool::JobsLock;
+condition_variable ImagePool::JobsReady;
+bool ImagePool::Running = false;
+atomic<bool> ImagePool::Cancelled(false);
+
+void ImagePool::Start()
+{
+    lock_guard<mutex> Lock(JobsLock);
+    if (Running)
+        return;
+
+    Running = true;
+    Cancelled = false;
+
+    // Leave a core for the main thread, decoding is memory bound anyway
+    unsigned NumWorkers = thread::hardware_concurrency();
+    NumWorkers = NumWorkers > 2 ? min(NumWorkers - 1, 4u) : 1;
+    for (unsigned i = 0; i < NumWorkers; ++i)
+        Workers.emplace_back(&ImagePool::Run);
+}
+
+// Cancels queued jobs and waits for the ones being decoded
+void ImagePool::Shutdown()
+{
+    {
+        lock_guard<mutex> Lock(JobsLock);
+        if (!Running)
+            return;
+        Running = false;
+        Cancelled = true;
+    }
+    JobsReady.notify_all();
+    for (thread& Worker : Workers)
+        Worker.join();
+    Workers.clear();
+}
+
+ImageFuture ImagePool::Decode(Resource Res, const string& Filename, bool Mask)
+{
+    Job Decoder([Res, Filename, Mask] (bool Cancel)
+    {
+        shared_ptr<Image> pImage(new Image);
+        if (!Cancel)
+            pImage->LoadImage(Res, Filename, Mask);
+        return pImage;
+    });
+    ImageFuture Future = Decoder.get_future().share();
+
+    {
+        lock_guard<mutex> Lock(JobsLock);
+        if (Running)
+        {
+            Jobs.push_back(move(Decoder));
+            JobsReady.notify_one();
+            return Future;
+        }
+    }
+
+    // Without workers the image is decoded right away
+    Decoder(false);
+    return Future;
+}
+
+void ImagePool::Run()
+{
+    while (true)
+    {
+        Job Decoder;
+        {
+            unique_lock<mutex> Lock(JobsLock);
+            JobsReady.wait(Lock, [] { return !Running || !Jobs.empty(); });
+            if (Jobs.empty())
+                return;
+            Decoder = move(Jobs.front());
+            Jobs.pop_front();
+        }
+        Decoder(Cancelled.load());
+    }
+}
@@ -20,8 +20,9 @@
 #include "scriptfile.hpp"
 #include "nsbconstants.hpp"
 
-NSBContext::NSBContext(const string& Name) : pText(nullptr), pObject(nullptr), Name(Name), WaitTime(0), Elapsed(0), WaitInterrupt(false), Active(false)
+NSBContext::NSBContext(const string& Name) : Scheduled(false), ReportedLimit(0), pText(nullptr), pObject(nullptr), WaitSerial(0), Name(Name), WaitTime(0), WaitInterrupt(false), Active(false)
 {
+    Types |= TYPE;
 }
 
 NSBContext::~NSBContext()
@@ -32,22 +33,27 @@ bool NSBContext::Call(ScriptFile* pScript, const string& Symbol)
 {
     uint32_t CodeLine = pScript->GetSymbol(Symbol);
     if (CodeLine == NSB_INVALIDE_LINE && Symbol.substr(0, 8) == "function")
-        if (!(pScript = sResourceMgr->ResolveSymbol(Symbol, CodeLine)))
+        if (!(pScript = sResourceMgr->ResolveSymbol(pScript, Symbol, CodeLine)))
             return false;
-    CallStack.push({pScript, CodeLine - 1});
+    Call(sResourceMgr->GetBytecode(pScript), CodeLine);
     return true;
 }
 
-void NSBContext::Jump(const string& Symbol)
+void NSBContext::Call(Bytecode* pCode, uint32_t CodeLine)
+{
+    CallStack.push({pCode->GetScript(), pCode, CodeLine - 1});
+}
+
+void NSBContext::Jump(uint32_t CodeLine)
 {
-    uint32_t CodeLine = GetScript()->GetSymbol(Symbol);
     if (CodeLine != NSB_INVALIDE_LINE)
         GetFrame()->SourceLine = CodeLine - 1;
 }
 
 void NSBContext::Break()
 {
-    Jump(BreakStack.top());
+    if (BreakStack.top().first == GetFrame()->pCode)
+        Jump(BreakStack.top().second);
 }
 
 const string& NSBContext::GetScriptName()
@@ -60,19 +66,34 @@ ScriptFile* NSBContext::GetScript()
     return GetFrame()->pScript;
 }
 
+Bytecode* NSBContext::GetCode()
+{
+    return GetFrame()->pCode;
+}
+
 Line* NSBContext::GetLine()
 {
     return GetScript()->GetLine(GetLineNumber());
 }
 
+Instruction* NSBContext::GetInstruction()
+{
+    return GetFrame()->pCode->GetInstruction(GetLineNumber());
+}
+
 const string& NSBContext::GetParam(uint32_t Index)
 {
-    return GetLine()->Params[Index];
+    return Bytecode::GetString(GetOperand(Index).Str);
+}
+
+const Operand& NSBContext::GetOperand(uint32_t Index)
+{
+    return GetFrame()->pCode->GetOperand(GetInstruction(), Index);
 }
 
 int NSBContext::GetNumParams()
 {
-    return GetLine()->Params.size();
+    return GetInstruction()->NumParams;
 }
 
 uint32_t NSBContext::GetLineNumber()
@@ -82,7 +103,7 @@ uint32_t NSBContext::GetLineNumber()
 
 uint32_t NSBContext::GetMagic()
 {
-    return GetLine()->Magic;
+    return GetInstruction()->Magic;
 }
 
 NSBContext::StackFrame* NSBContext::GetFrame()
@@ -101,6 +122,11 @@ void NSBContext::Rewind()
     GetFrame()->SourceLine--;
 }
 
+void NSBContext::Skip(uint32_t Count)
+{
+    GetFrame()->SourceLine += Count;
+}
+
 void NSBContext::Return()
 {
     CallStack.pop();
@@ -108,7 +134,12 @@ void NSBContext::Return()
 
 void NSBContext::PushBreak()
 {
-    BreakStack.push(GetParam(0));
+    PushBreak(GetOperand(0).Int);
+}
+
+void NSBContext::PushBreak(uint32_t CodeLine)
+{
+    BreakStack.push(make_pair(GetFrame()->pCode, CodeLine));
 }
 
 void NSBContext::PopBreak()
@@ -125,6 +156,7 @@ void NSBContext::WaitText(Text* pText, int32_t Time)
 void NSBContext::WaitAction(Object* pObject, int32_t Time)
 {
     this->pObject = pObject;
+    WaitSerial = pObject->Serial;
     Wait(Time);
 }
 
@@ -137,23 +169,17 @@ void NSBContext::Wait(int32_t Time, bool Interrupt)
 {
     WaitInterrupt = Interrupt;
     WaitTime = Time;
-    Elapsed = 0;
 }
 
 void NSBContext::Wake()
 {
     pObject = nullptr;
+    WaitSerial = 0;
     pText = nullptr;
     WaitInterrupt = false;
     WaitTime = 0;
 }
 
-void NSBContext::TryWake()
-{
-    if (pObject && pObject->Action())
-        Wake();
-}
-
 void NSBContext::OnClick()
 {
     if (WaitInterrupt || (pText && !pText->Advance()))
@@ -167,7 +193,7 @@ bool NSBContext::IsStarving()
 
 bool NSBContext::IsSleeping()
 {
-    return pText || Elapsed < WaitTime;
+    return pText || WaitTime > 0;
 }
 
 bool NSBContext::IsActive()
@@ -175,6 +201,31 @@ bool NSBContext::IsActive()
     return Active;
 }
 
+bool NSBContext::IsRunnable()
+{
+    return Active && !CallStack.empty() && !pText && WaitTime == 0;
+}
+
+bool NSBContext::IsWaitingText()
+{
+    return pText;
+}
+
+Object* NSBContext::GetWaitObject()
+{
+    return pObject;
+}
+
+uint32_t NSBContext::GetWaitSerial()
+{
+    return WaitSerial;
+}
+
+uint64_t NSBContext::GetWaitTime()
+{
+    return WaitTime;
+}
+
 void NSBContext::Start()
 {
     Active = true;
@@ -201,18 +252,23 @@ const string& NSBContext::GetName()
 
 void NSBContext::WriteTrace(ostream& Stream)
 {
+    vector<pair<Bytecode*, uint32_t>> Frames;
+    GetTrace(Frames);
+    for (auto& Frame : Frames)
+        Stream << Frame.first->GetScript()->GetName() << " at " << Frame.second << endl;
+}
+
+// Code and line of every frame, innermost first
+void NSBContext::GetTrace(vector<pair<Bytecode*, uint32_t>>& Frames)
+{
+    Frames.clear();
     if (!GetScript())
         return;
 
     stack<StackFrame> Returns = CallStack;
     while (!Returns.empty())
     {
-        Stream << Returns.top().pScript->GetName() << " at " << Returns.top().SourceLine << endl;
+        Frames.push_back(make_pair(Returns.top().pCode, Returns.top().SourceLine));
         Returns.pop();
     }
 }
-
-void NSBContext::Update(uint32_t Diff)
-{
-    Elapsed += Diff;
-}
@@ -20,7 +20,10 @@
 #include "Window.hpp"
 #include "nsbmagic.hpp"
 #include "scriptfile.hpp"
+#include "Tracer.hpp"
 #include <boost/algorithm/string.hpp>
+#include <chrono>
+#include <fstream>
 
 void NSBInterpreter::StartDebugger()
 {
@@ -34,7 +37,12 @@ void NSBInterpreter::SetBreakpoint(const string& Script, int32_t LineNumber)
     if (ScriptFile* pScript = sResourceMgr->GetScriptFile(Script))
     {
         if (pScript->GetLine(LineNumber))
-            Breakpoints.push_back(make_pair(Script, LineNumber));
+        {
+            vector<bool>& Lines = Breakpoints[pScript];
+            if (Lines.size() <= (uint32_t)LineNumber)
+                Lines.resize(LineNumber + 1, false);
+            Lines[LineNumber] = true;
+        }
     }
     else
         cout << "Cannot set breakpoint " << Script << ":" << LineNumber << endl;
@@ -42,7 +50,7 @@ void NSBInterpreter::SetBreakpoint(const string& Script, int32_t LineNumber)
 
 void NSBInterpreter::PrintVariable(Variable* pVar)
 {
-    cout << pVar->Name << " = ";
+    cout << pVar->GetName() << " = ";
     if (pVar->IsInt())
         cout << pVar->ToInt() << endl;
     else if (pVar->IsString())
@@ -63,15 +71,16 @@ void NSBInterpreter::DebuggerTick()
     }
 
     // Breakpoint
-    for (auto i : Breakpoints)
-    {
-        if (i.first == pContext->GetScriptName() &&
-            i.second == pContext->GetLineNumber())
-        {
-            DbgBreak(true);
-            return;
-        }
-    }
+    if (Breakpoints.empty())
+        return;
+
+    auto iter = Breakpoints.find(pContext->GetScript());
+    if (iter == Breakpoints.end())
+        return;
+
+    uint32_t LineNumber = pContext->GetLineNumber();
+    if (LineNumber < iter->second.size() && iter->second[LineNumber])
+        DbgBreak(true);
 }
 
 void NSBInterpreter::DbgBreak(bool Break)
@@ -119,6 +128,28 @@ void NSBInterpreter::DebuggerMain()
         // Log
         else if (Command == "l")
             LogCalls = !LogCalls;
+        // Allocations
+        else if (Command == "a")
+        {
+            cout << "Stack allocations: " << Params.GetNumAllocs()
+                 << " (arena size " << Params.GetArenaSize() << ")" << endl;
+            cout << "String allocations: " << Variable::NumStringAllocs << endl;
+        }
+        // Instruction throughput
+        else if (Command == "r")
+        {
+            // The rate is since the previous query, so the first one has none
+            static uint64_t LastCount = 0;
+            static chrono::steady_clock::time_point LastTime;
+            auto Now = chrono::steady_clock::now();
+            cout << "Instructions: " << NumInstructions;
+            double Seconds = chrono::duration<double>(Now - LastTime).count();
+            if (LastTime != chrono::steady_clock::time_point() && Seconds > 0)
+                cout << " (" << uint64_t((NumInstructions - LastCount) / Seconds) << "/s)";
+            cout << endl;
+            LastCount = NumInstructions;
+            LastTime = Now;
+        }
         // Thread Trace
         else if (Command == "t")
         {
@@ -146,6 +177,56 @@ void NSBInterpreter::DebuggerMain()
             {
                 Breakpoints.clear();
             }
+            // Profiler start, optionally with the sample interval in microseconds
+            else if (Tokens.size() >= 2 && Tokens.size() <= 3 && Tokens[0] == "pf" && Tokens[1] == "s")
+            {
+                try
+                {
+                    Profile.Start(Tokens.size() == 3 ? stoi(Tokens[2]) : 1000);
+                } catch (...) { cout << "Bad command!" << endl; }
+            }
+            // Profiler stop
+            else if (Tokens.size() == 2 && Tokens[0] == "pf" && Tokens[1] == "x")
+            {
+                Profile.Stop();
+            }
+            // Profiler report
+            else if (Tokens.size() == 2 && Tokens[0] == "pf" && Tokens[1] == "r")
+            {
+                Profile.WriteReport(cout);
+            }
+            // Timeline trace start
+            else if (Tokens.size() == 3 && Tokens[0] == "tr" && Tokens[1] == "s")
+            {
+                Tracer::Start(Tokens[2]);
+            }
+            // Timeline trace stop
+            else if (Tokens.size() == 2 && Tokens[0] == "tr" && Tokens[1] == "x")
+            {
+                Tracer::Stop();
+            }
+            // Timeline trace flush
+            else if (Tokens.size() == 2 && Tokens[0] == "tr" && Tokens[1] == "w")
+            {
+                Tracer::Flush();
+            }
+            // Profiler folded stacks, for flamegraph.pl
+            else if (Tokens.size() == 3 && Tokens[0] == "pf" && Tokens[1] == "w")
+            {
+                ofstream File(Tokens[2]);
+                if (File)
+                    Profile.WriteFolded(File);
+                else
+                    cout << "Cannot open " << Tokens[2] << endl;
+            }
+            // Watchdog slice limit in microseconds
+            else if (Tokens.size() == 2 && Tokens[0] == "wd")
+            {
+                try
+                {
+                    SetSliceLimit(stoul(Tokens[1]));
+                } catch (...) { cout << "Bad command!" << endl; }
+            }
             // Print
             else if (Tokens.size() == 2 && Tokens[0] == "p")
             {
@@ -170,7 +251,7 @@ void NSBInterpreter::DebuggerMain()
             {
                 for (auto i : VariableHolder.Cache)
                 {
-                    assert(i.first == i.second->Name);
+                    assert(i.first == i.second->GetName());
                     PrintVariable(i.second);
                 }
             }
@@ -18,6 +18,7 @@
 #include "NSBInterpreter.hpp"
 #include "NSBContext.hpp"
 #include "Texture.hpp"
+#include "Tracer.hpp"
 #include "Image.hpp"
 #include "Window.hpp"
 #include "Movie.hpp"
@@ -34,12 +35,79 @@
 #include <iostream>
 #include <memory>
 #include <algorithm>
+#include <chrono>
 
 #define NSB_ERROR(MSG1, MSG2) cout << __PRETTY_FUNCTION__ << ": " << MSG1 << " " << MSG2 << endl;
 #define NSB_VARARGS 0xFF
 
 extern "C" { void gst_init(int* argc, char** argv[]); }
 
+template <> int32_t NSBInterpreter::Pop<int32_t>() { return PopInt(); }
+template <> bool NSBInterpreter::Pop<bool>() { return PopBool(); }
+template <> string NSBInterpreter::Pop<string>() { return PopString(); }
+template <> NSBString NSBInterpreter::Pop<NSBString>()
+{
+    Variable* pVar = PopVar();
+    uint32_t Id = pVar->GetStringId();
+    if (Id != Variable::NO_STRING)
+        return NSBString(&Bytecode::GetString(Id));
+    return NSBString(pVar->ToString());
+}
+template <> uint32_t NSBInterpreter::Pop<uint32_t>() { return PopColor(); }
+template <> NSBPosition NSBInterpreter::Pop<NSBPosition>() { return PopPos(); }
+template <> NSBRelative NSBInterpreter::Pop<NSBRelative>() { return PopRelative(); }
+template <> NSBTempo NSBInterpreter::Pop<NSBTempo>() { return PopTempo(); }
+template <> NSBRequest NSBInterpreter::Pop<NSBRequest>() { return {PopRequest()}; }
+template <> NSBTone NSBInterpreter::Pop<NSBTone>() { return {PopTone()}; }
+template <> NSBShade NSBInterpreter::Pop<NSBShade>() { return {PopShade()}; }
+template <> NSBOptional NSBInterpreter::Pop<NSBOptional>()
+{
+    if (!Params.HasNext())
+        return {false, 0};
+    return {true, PopInt()};
+}
+template <> Variable* NSBInterpreter::Pop<Variable*>() { return PopVar(); }
+template <> Texture* NSBInterpreter::Pop<Texture*>() { return PopTexture(); }
+template <> GLTexture* NSBInterpreter::Pop<GLTexture*>() { return PopGLTexture(); }
+template <> Playable* NSBInterpreter::Pop<Playable*>() { return PopPlayable(); }
+
+// const string& parameters are popped without copying literals
+template <class T> struct NSBArg { typedef typename decay<T>::type Type; };
+template <> struct NSBArg<const string&> { typedef NSBString Type; };
+
+/*
+ * Calls a typed builtin with its arguments popped in declaration order.
+ * Braced initialization guarantees left to right evaluation of the pops.
+ * */
+template <class... Args, void (NSBInterpreter::*Func)(Args...)>
+struct NSBInterpreter::Thunk<void (NSBInterpreter::*)(Args...), Func>
+{
+    static_assert(sizeof...(Args) < NSB_VARARGS, "Too many builtin parameters");
+    static const uint8_t NumParams = sizeof...(Args);
+
+    Thunk(NSBInterpreter* pThis, Args... Params)
+    {
+        (pThis->*Func)(std::forward<Args>(Params)...);
+    }
+
+    static void Call(NSBInterpreter* pThis)
+    {
+        Thunk{pThis, pThis->Pop<typename NSBArg<Args>::Type>()...};
+    }
+};
+
+template <class F, F Func>
+NSBInterpreter::NSBFunction NSBInterpreter::MakeTyped()
+{
+    return { &NSBInterpreter::Typed<F, Func>, Thunk<F, Func>::NumParams };
+}
+
+// The number of parameters of a typed builtin is taken from its signature
+#define NSB_TYPED(Func) MakeTyped<decltype(&NSBInterpreter::Func), &NSBInterpreter::Func>()
+
+// Typed builtins whose trailing NSBOptional parameters may be left out
+#define NSB_TYPED_VARARGS(Func) NSBFunction(&NSBInterpreter::Typed<decltype(&NSBInterpreter::Func), &NSBInterpreter::Func>, NSB_VARARGS)
+
 NSBInterpreter::NSBInterpreter(Window* pWindow) :
 pDebuggerThread(nullptr),
 LogCalls(false),
@@ -48,7 +116,11 @@ RunInterpreter(true),
 SkipHack(false),
 pWindow(pWindow),
 pContext(nullptr),
-Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
+Builtins(MAGIC_UNK119 + 1, {nullptr, 0}),
+NumInstructions(0),
+NextTicket(0),
+Clock(0),
+SliceLimit(5000)
 {
     gst_init(nullptr, nullptr);
     srand(time(0));
@@ -95,17 +167,17 @@ Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
     Builtins[MAGIC_MOD_ASSIGN] = { &NSBInterpreter::ModAssign, 1 };
     Builtins[MAGIC_WRITE_FILE] = { &NSBInterpreter::WriteFile, 2 };
     Builtins[MAGIC_READ_FILE] = { &NSBInterpreter::ReadFile, 1 };
-    Builtins[MAGIC_CREATE_TEXTURE] = { &NSBInterpreter::CreateTexture, 5 };
-    Builtins[MAGIC_IMAGE_HORIZON] = { &NSBInterpreter::ImageHorizon, 1 };
-    Builtins[MAGIC_IMAGE_VERTICAL] = { &NSBInterpreter::ImageVertical, 1 };
+    Builtins[MAGIC_CREATE_TEXTURE] = NSB_TYPED(CreateTexture);
+    Builtins[MAGIC_IMAGE_HORIZON] = NSB_TYPED(ImageHorizon);
+    Builtins[MAGIC_IMAGE_VERTICAL] = NSB_TYPED(ImageVertical);
     Builtins[MAGIC_TIME] = { &NSBInterpreter::Time, 0 };
     Builtins[MAGIC_STR_STR] = { &NSBInterpreter::StrStr, 2 };
     Builtins[MAGIC_EXIT] = { &NSBInterpreter::Exit, 0 };
     Builtins[MAGIC_CURSOR_POSITION] = { &NSBInterpreter::CursorPosition, 2 };
     Builtins[MAGIC_MOVE_CURSOR] = { &NSBInterpreter::MoveCursor, 2 };
     Builtins[MAGIC_POSITION] = { &NSBInterpreter::Position, 3 };
-    Builtins[MAGIC_WAIT] = { &NSBInterpreter::Wait, 1 };
-    Builtins[MAGIC_WAIT_KEY] = { &NSBInterpreter::WaitKey, NSB_VARARGS };
+    Builtins[MAGIC_WAIT] = NSB_TYPED(Wait);
+    Builtins[MAGIC_WAIT_KEY] = NSB_TYPED_VARARGS(WaitKey);
     Builtins[MAGIC_NEGA_EXPRESSION] = { &NSBInterpreter::NegaExpression, 1 };
     Builtins[MAGIC_SYSTEM] = { &NSBInterpreter::System, 3 };
     Builtins[MAGIC_STRING] = { &NSBInterpreter::String, NSB_VARARGS };
@@ -116,40 +188,40 @@ Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
     Builtins[MAGIC_SUB_SCRIPT] = { &NSBInterpreter::SubScript, 0 };
     Builtins[MAGIC_ASSOC_ARRAY] = { &NSBInterpreter::AssocArray, NSB_VARARGS };
     Builtins[MAGIC_MODULE_FILE_NAME] = { &NSBInterpreter::ModuleFileName, 0 };
-    Builtins[MAGIC_REQUEST] = { &NSBInterpreter::Request, 2 };
-    Builtins[MAGIC_SET_VERTEX] = { &NSBInterpreter::SetVertex, 3 };
-    Builtins[MAGIC_ZOOM] = { &NSBInterpreter::Zoom, 6 };
-    Builtins[MAGIC_MOVE] = { &NSBInterpreter::Move, 6 };
-    Builtins[MAGIC_SET_SHADE] = { &NSBInterpreter::SetShade, 2 };
-    Builtins[MAGIC_DRAW_TO_TEXTURE] = { &NSBInterpreter::DrawToTexture, 4 };
+    Builtins[MAGIC_REQUEST] = NSB_TYPED(Request);
+    Builtins[MAGIC_SET_VERTEX] = NSB_TYPED(SetVertex);
+    Builtins[MAGIC_ZOOM] = NSB_TYPED(Zoom);
+    Builtins[MAGIC_MOVE] = NSB_TYPED(Move);
+    Builtins[MAGIC_SET_SHADE] = NSB_TYPED(SetShade);
+    Builtins[MAGIC_DRAW_TO_TEXTURE] = NSB_TYPED(DrawToTexture);
     Builtins[MAGIC_CREATE_RENDER_TEXTURE] = { &NSBInterpreter::CreateRenderTexture, 4 };
-    Builtins[MAGIC_DRAW_TRANSITION] = { &NSBInterpreter::DrawTransition, 8 };
-    Builtins[MAGIC_CREATE_COLOR] = { &NSBInterpreter::CreateColor, 7 };
-    Builtins[MAGIC_LOAD_IMAGE] = { &NSBInterpreter::LoadImage, 2 };
-    Builtins[MAGIC_FADE] = { &NSBInterpreter::Fade, 5 };
-    Builtins[MAGIC_DELETE] = { &NSBInterpreter::Delete, 1 };
+    Builtins[MAGIC_DRAW_TRANSITION] = NSB_TYPED(DrawTransition);
+    Builtins[MAGIC_CREATE_COLOR] = NSB_TYPED(CreateColor);
+    Builtins[MAGIC_LOAD_IMAGE] = NSB_TYPED(LoadImage);
+    Builtins[MAGIC_FADE] = NSB_TYPED(Fade);
+    Builtins[MAGIC_DELETE] = NSB_TYPED(Delete);
     Builtins[MAGIC_CLEAR_PARAMS] = { &NSBInterpreter::ClearParams, 0 };
-    Builtins[MAGIC_SET_LOOP] = { &NSBInterpreter::SetLoop, 2 };
-    Builtins[MAGIC_SET_VOLUME] = { &NSBInterpreter::SetVolume, 4 };
-    Builtins[MAGIC_SET_LOOP_POINT] = { &NSBInterpreter::SetLoopPoint, 3 };
-    Builtins[MAGIC_CREATE_SOUND] = { &NSBInterpreter::CreateSound, 3 };
-    Builtins[MAGIC_REMAIN_TIME] = { &NSBInterpreter::RemainTime, 1 };
-    Builtins[MAGIC_CREATE_MOVIE] = { &NSBInterpreter::CreateMovie, 8 };
-    Builtins[MAGIC_DURATION_TIME] = { &NSBInterpreter::DurationTime, 1 };
-    Builtins[MAGIC_SET_FREQUENCY] = { &NSBInterpreter::SetFrequency, 4 };
-    Builtins[MAGIC_SET_PAN] = { &NSBInterpreter::SetPan, 4 };
-    Builtins[MAGIC_SET_ALIAS] = { &NSBInterpreter::SetAlias, 2 };
-    Builtins[MAGIC_CREATE_NAME] = { &NSBInterpreter::CreateName, 1 };
-    Builtins[MAGIC_CREATE_WINDOW] = { &NSBInterpreter::CreateWindow, 7 };
+    Builtins[MAGIC_SET_LOOP] = NSB_TYPED(SetLoop);
+    Builtins[MAGIC_SET_VOLUME] = NSB_TYPED(SetVolume);
+    Builtins[MAGIC_SET_LOOP_POINT] = NSB_TYPED(SetLoopPoint);
+    Builtins[MAGIC_CREATE_SOUND] = NSB_TYPED(CreateSound);
+    Builtins[MAGIC_REMAIN_TIME] = NSB_TYPED(RemainTime);
+    Builtins[MAGIC_CREATE_MOVIE] = NSB_TYPED(CreateMovie);
+    Builtins[MAGIC_DURATION_TIME] = NSB_TYPED(DurationTime);
+    Builtins[MAGIC_SET_FREQUENCY] = NSB_TYPED(SetFrequency);
+    Builtins[MAGIC_SET_PAN] = NSB_TYPED(SetPan);
+    Builtins[MAGIC_SET_ALIAS] = NSB_TYPED(SetAlias);
+    Builtins[MAGIC_CREATE_NAME] = NSB_TYPED(CreateName);
+    Builtins[MAGIC_CREATE_WINDOW] = NSB_TYPED(CreateWindow);
     Builtins[MAGIC_CREATE_CHOICE] = { &NSBInterpreter::CreateChoice, NSB_VARARGS };
     Builtins[MAGIC_CASE] = { &NSBInterpreter::Case, 0 };
     Builtins[MAGIC_CASE_END] = { &NSBInterpreter::CaseEnd, 0 };
-    Builtins[MAGIC_SET_NEXT_FOCUS] = { &NSBInterpreter::SetNextFocus, 3 };
-    Builtins[MAGIC_PASSAGE_TIME] = { &NSBInterpreter::PassageTime, 1 };
+    Builtins[MAGIC_SET_NEXT_FOCUS] = NSB_TYPED(SetNextFocus);
+    Builtins[MAGIC_PASSAGE_TIME] = NSB_TYPED(PassageTime);
     Builtins[MAGIC_PARSE_TEXT] = { &NSBInterpreter::ParseText, 0 };
     Builtins[MAGIC_LOAD_TEXT] = { &NSBInterpreter::LoadText, 7 };
-    Builtins[MAGIC_WAIT_TEXT] = { &NSBInterpreter::WaitText, 2 };
-    Builtins[MAGIC_LOCK_VIDEO] = { &NSBInterpreter::LockVideo, 1 };
+    Builtins[MAGIC_WAIT_TEXT] = NSB_TYPED(WaitText);
+    Builtins[MAGIC_LOCK_VIDEO] = NSB_TYPED(LockVideo);
     Builtins[MAGIC_SAVE] = { &NSBInterpreter::Save, 1 };
     Builtins[MAGIC_DELETE_SAVE_FILE] = { &NSBInterpreter::DeleteSaveFile, 1};
     Builtins[MAGIC_CONQUEST] = { &NSBInterpreter::Conquest, 3 };
@@ -157,36 +229,37 @@ Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
     Builtins[MAGIC_CLEAR_BACKLOG] = { &NSBInterpreter::ClearBacklog, 0 };
     Builtins[MAGIC_SET_FONT] = { &NSBInterpreter::SetFont, 6 };
     Builtins[MAGIC_SET_SHORTCUT] = { &NSBInterpreter::SetShortcut, 2 };
-    Builtins[MAGIC_CREATE_CLIP_TEXTURE] = { &NSBInterpreter::CreateClipTexture, 9 };
+    Builtins[MAGIC_CREATE_CLIP_TEXTURE] = NSB_TYPED(CreateClipTexture);
     Builtins[MAGIC_EXIST_SAVE] = { &NSBInterpreter::ExistSave, 1 };
-    Builtins[MAGIC_WAIT_ACTION] = { &NSBInterpreter::WaitAction, NSB_VARARGS };
+    Builtins[MAGIC_WAIT_ACTION] = NSB_TYPED_VARARGS(WaitAction);
     Builtins[MAGIC_LOAD] = { &NSBInterpreter::Load, 1 };
     Builtins[MAGIC_SET_BACKLOG] = { &NSBInterpreter::SetBacklog, 3 };
-    Builtins[MAGIC_CREATE_TEXT] = { &NSBInterpreter::CreateText, 7 };
+    Builtins[MAGIC_CREATE_TEXT] = NSB_TYPED(CreateText);
     Builtins[MAGIC_AT_EXPRESSION] = { &NSBInterpreter::AtExpression, 1 };
     Builtins[MAGIC_RANDOM] = { &NSBInterpreter::Random, 1 };
-    Builtins[MAGIC_CREATE_EFFECT] = { &NSBInterpreter::CreateEffect, 7 };
-    Builtins[MAGIC_SET_TONE] = { &NSBInterpreter::SetTone, 2 };
+    Builtins[MAGIC_CREATE_EFFECT] = NSB_TYPED(CreateEffect);
+    Builtins[MAGIC_SET_TONE] = NSB_TYPED(SetTone);
     Builtins[MAGIC_DATE_TIME] = { &NSBInterpreter::DateTime, 6};
-    Builtins[MAGIC_SHAKE] = { &NSBInterpreter::Shake, 9};
-    Builtins[MAGIC_MOVIE_PLAY] = { &NSBInterpreter::MoviePlay, 2};
-    Builtins[MAGIC_SET_STREAM] = { &NSBInterpreter::SetStream, 2};
-    Builtins[MAGIC_WAIT_PLAY] = { &NSBInterpreter::WaitPlay, 2};
-    Builtins[MAGIC_WAIT_FADE] = { &NSBInterpreter::WaitFade, 2};
-    Builtins[MAGIC_SOUND_AMPLITUDE] = { &NSBInterpreter::SoundAmplitude, 2};
-    Builtins[MAGIC_ROTATE] = { &NSBInterpreter::Rotate, 7};
+    Builtins[MAGIC_SHAKE] = NSB_TYPED(Shake);
+    Builtins[MAGIC_MOVIE_PLAY] = NSB_TYPED(MoviePlay);
+    Builtins[MAGIC_SET_STREAM] = NSB_TYPED(SetStream);
+    Builtins[MAGIC_WAIT_PLAY] = NSB_TYPED(WaitPlay);
+    Builtins[MAGIC_WAIT_FADE] = NSB_TYPED(WaitFade);
+    Builtins[MAGIC_SOUND_AMPLITUDE] = NSB_TYPED(SoundAmplitude);
+    Builtins[MAGIC_ROTATE] = NSB_TYPED(Rotate);
     Builtins[MAGIC_MESSAGE] = { &NSBInterpreter::Message, 4};
     Builtins[MAGIC_INTEGER] = { &NSBInterpreter::Integer, 1};
     Builtins[MAGIC_CREATE_SCROLLBAR] = { &NSBInterpreter::CreateScrollbar, 14};
     Builtins[MAGIC_SET_SCROLLBAR_VALUE] = { &NSBInterpreter::SetScrollbarValue, 2};
     Builtins[MAGIC_SET_SCROLLBAR_WHEEL_AREA] = { &NSBInterpreter::SetScrollbarWheelArea, 5};
     Builtins[MAGIC_SCROLLBAR_VALUE] = { &NSBInterpreter::ScrollbarValue, 1};
-    Builtins[MAGIC_CREATE_STENCIL] = { &NSBInterpreter::CreateStencil, 7};
-    Builtins[MAGIC_CREATE_MASK] = { &NSBInterpreter::CreateMask, 6};
+    Builtins[MAGIC_CREATE_STENCIL] = NSB_TYPED(CreateStencil);
+    Builtins[MAGIC_CREATE_MASK] = NSB_TYPED(CreateMask);
+
+    WatchVariable("#SYSTEM_window_full");
 
     pContext = new NSBContext("__main__");
-    pContext->Start();
-    Threads.push_back(pContext);
+    AddThread(pContext);
 }
 
 NSBInterpreter::~NSBInterpreter()
@@ -221,10 +294,23 @@ void NSBInterpreter::ExecuteScriptThread(const string& Filename)
         pThread->Call(pScript, "chapter.main");
 }
 
-void NSBInterpreter::Run(int NumCommands)
+// Monotonic time in microseconds
+static uint64_t GetTime()
 {
-    for (int i = 0; i < NumCommands; ++i)
+    using namespace chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Runs statements for at most Budget microseconds, or until every thread
+ * is asleep. Each RunCommand gives every ready thread one statement.
+ * */
+void NSBInterpreter::Run(uint64_t Budget)
+{
+    uint64_t Start = GetTime();
+    do
         RunCommand();
+    while (RunInterpreter && !Ready.empty() && GetTime() - Start < Budget);
 }
 
 void NSBInterpreter::RunCommand()
@@ -235,42 +321,160 @@ void NSBInterpreter::RunCommand()
     if (!RunInterpreter)
         return;
 
-    ThreadsModified = false;
-    for (auto i = Threads.begin(); i != Threads.end(); ++i)
+    ObjectHolder_t::Trim();
+
+    // Threads added during this round wait for the next one
+    for (size_t i = Ready.size(); i > 0 && !Ready.empty(); --i)
     {
-        pContext = *i;
-        pContext->TryWake();
+        pContext = Ready.front();
+        Ready.pop_front();
 
-        while (pContext->IsActive() && !pContext->IsStarving() && !pContext->IsSleeping() && pContext->Advance() != MAGIC_CLEAR_PARAMS)
-        {
-            if (pContext->GetName() == "__main__")
-                DebuggerTick();
+        uint64_t Start = GetTime();
+        bool Debug = pDebuggerThread && pContext->GetName() == "__main__";
+        if (Profile.IsRunning())
+            Debug ? RunThread<true, true>() : RunThread<false, true>();
+        else
+            Debug ? RunThread<true, false>() : RunThread<false, false>();
+        ClearParams();
+        uint64_t Slice = GetTime() - Start;
+        if (Tracer::IsEnabled())
+            Tracer::Add(pContext->GetName().c_str(), "script", Start, Slice);
 
-            if (pContext->GetMagic() < Builtins.size())
-                 Call(pContext->GetMagic());
+        // Each thread is reported once per limit, slow threads are slow every frame
+        uint64_t Limit = SliceLimit;
+        if (Slice > Limit && pContext->ReportedLimit != Limit)
+        {
+            pContext->ReportedLimit = Limit;
+            cout << "Thread " << pContext->GetName() << " exceeded its slice: " << Slice << "us";
+            if (!pContext->IsStarving())
+                cout << " at " << pContext->GetScriptName() << ":" << pContext->GetLineNumber();
+            cout << endl;
         }
 
-        ClearParams();
         if (pContext->IsStarving())
         {
             ObjectHolder.Delete(pContext->GetName());
             RemoveThread(pContext);
         }
-
-        if (ThreadsModified)
-            break;
+        else if (!Suspend(pContext))
+            Ready.push_back(pContext);
     }
 }
 
 void NSBInterpreter::Update(uint32_t Diff)
 {
-    for (NSBContext* pContext : Threads)
-        pContext->Update(Diff);
+    Clock += Diff;
+    while (!Timers.empty() && Timers.top().Deadline <= Clock)
+    {
+        Timer Expired = Timers.top();
+        Timers.pop();
+
+        auto iter = Sleeping.find(Expired.pThread);
+        if (iter == Sleeping.end() || iter->second != Expired.Ticket)
+            continue;
+
+        Expired.pThread->Wake();
+        MakeReady(Expired.pThread);
+    }
+}
+
+/*
+ * Idle interpreter has nothing to do until a click, key or timer. (see: Window::Run)
+ * */
+bool NSBInterpreter::IsIdle()
+{
+    return Ready.empty();
+}
+
+// Milliseconds until the earliest timer, which may be stale
+uint64_t NSBInterpreter::GetNextDeadline()
+{
+    if (Timers.empty())
+        return UINT64_MAX;
+    return Timers.top().Deadline > Clock ? Timers.top().Deadline - Clock : 0;
+}
+
+void NSBInterpreter::MakeReady(NSBContext* pThread)
+{
+    Sleeping.erase(pThread);
+    if (!pThread->Scheduled)
+    {
+        pThread->Scheduled = true;
+        Ready.push_back(pThread);
+    }
+}
+
+/*
+ * Parks a thread which can no longer run. Returns false if the thread
+ * should stay in the ready queue.
+ * */
+bool NSBInterpreter::Suspend(NSBContext* pThread)
+{
+    if (pThread->IsRunnable() || !pThread->IsActive())
+        return false;
+
+    if (pThread->IsWaitingText())
+    {
+        pThread->Scheduled = false;
+        return true;
+    }
+
+    if (Object* pObject = pThread->GetWaitObject())
+    {
+        // Already done, otherwise Object::Signal will wake the thread
+        if (pObject->Action())
+        {
+            pThread->Wake();
+            return false;
+        }
+
+        auto Range = Waiters.equal_range(pObject->Serial);
+        if (find_if(Range.first, Range.second, [pThread](const pair<const uint32_t, NSBContext*>& Waiter)
+            { return Waiter.second == pThread; }) == Range.second)
+            Waiters.insert(make_pair(pObject->Serial, pThread));
+    }
+
+    pThread->Scheduled = false;
+    uint64_t WaitTime = pThread->GetWaitTime();
+    if (WaitTime > UINT64_MAX - Clock)
+        return true;
+
+    Sleeping[pThread] = ++NextTicket;
+    Timers.push({Clock + WaitTime, NextTicket, pThread});
+    return true;
+}
+
+/*
+ * Completion signal of an object (see: Object::Signal). Wakes the threads
+ * which are still waiting for it.
+ * */
+void NSBInterpreter::OnSignal(uint32_t Serial)
+{
+    auto Range = Waiters.equal_range(Serial);
+    vector<NSBContext*> Woken;
+    for (auto i = Range.first; i != Range.second; ++i)
+        Woken.push_back(i->second);
+    Waiters.erase(Range.first, Range.second);
+
+    for (NSBContext* pThread : Woken)
+    {
+        if (pThread->GetWaitSerial() != Serial || !pThread->IsSleeping())
+            continue;
+
+        pThread->Wake();
+        MakeReady(pThread);
+    }
 }
 
 void NSBInterpreter::PushEvent(const SDL_Event& Event)
 {
     Events.push(Event);
+    for (NSBContext* pThread : Selecting)
+    {
+        pThread->Wake();
+        MakeReady(pThread);
+    }
+    Selecting.clear();
 }
 
 void NSBInterpreter::HandleEvent(const SDL_Event& Event)
@@ -286,7 +490,11 @@ void NSBInterpreter::HandleEvent(const SDL_Event& Event)
     case SDL_MOUSEBUTTONDOWN:
         ProcessButton(Event.button.button, "true");
         for (auto pContext : Threads)
+        {
             pContext->OnClick();
+            if (pContext->IsRunnable())
+                MakeReady(pContext);
+        }
         break;
     case SDL_MOUSEBUTTONUP:
         ProcessButton(Event.button.button, "false");
@@ -355,7 +563,11 @@ void NSBInterpreter::FunctionDeclaration()
 
 void NSBInterpreter::CallFunction()
 {
-    CallFunction_(pContext, pContext->GetParam(0));
+    CallTarget& Target = pContext->GetCode()->ResolveCall(pContext->GetOperand(0));
+    if (Target.pCode)
+        pContext->Call(Target.pCode, Target.CodeLine);
+    else
+        NSB_ERROR("Failed to call function", pContext->GetParam(0));
 }
 
 void NSBInterpreter::CallScene()
@@ -423,9 +635,7 @@ void NSBInterpreter::CmpEqual()
     else if (pLhs->ToFloat() && pRhs->ToFloat())
         Equal = pLhs->ToFloat() == pRhs->ToFloat();
 
-    Variable::Destroy(pLhs);
-    Variable::Destroy(pRhs);
-    PushVar(Variable::MakeInt(Equal));
+    PushInt(Equal);
 }
 
 void NSBInterpreter::CmpNE()
@@ -436,7 +646,7 @@ void NSBInterpreter::CmpNE()
 
 void NSBInterpreter::NotExpression()
 {
-    PushVar(Variable::MakeInt(!PopBool()));
+    PushInt(!PopBool());
 }
 
 void NSBInterpreter::AddExpression()
@@ -447,7 +657,9 @@ void NSBInterpreter::AddExpression()
     {
         Variable* pLhs = PopVar();
         Variable* pRhs = PopVar();
-        PushVar(Variable::Add(pLhs, pRhs));
+        Variable* pSum = Params.Temporary();
+        Variable::Add(pLhs, pRhs, pSum);
+        PushVar(pSum);
     }
 }
 
@@ -482,7 +694,8 @@ void NSBInterpreter::ModExpression()
 
 void NSBInterpreter::Increment()
 {
-    if (Params.Top()->Name == "$SW_PHONE_SENDMAILNO")
+    static const uint32_t SendMailNo = Bytecode::Intern("$SW_PHONE_SENDMAILNO");
+    if (Params.Top() == VariableHolder.Read(SendMailNo))
     {
         Variable* pVar = PopVar();
         int32_t Index = Nsb::ConstantToValue<Nsb::PhoneMail>(pVar->ToString());
@@ -501,30 +714,33 @@ void NSBInterpreter::Decrement()
 
 void NSBInterpreter::Literal()
 {
-    const string& Type = pContext->GetParam(0);
-    const string& Val = pContext->GetParam(1);
-    if (Type == "STRING")
+    const Operand& Val = pContext->GetOperand(1);
+    switch (Val.Type)
     {
-        if (Variable* pVar = VariableHolder.Read(Val))
-            PushVar(pVar);
-        else
-            PushString(Val);
+        case Operand::STRING:
+            if (Variable* pVar = VariableHolder.Read(Val.Str))
+                PushVar(pVar);
+            else
+                PushLiteral(Val.Str);
+            break;
+        case Operand::INT:
+            PushInt(Val.Int);
+            break;
+        case Operand::FLOAT:
+            PushFloat(Val.Float);
+            break;
     }
-    else if (Type == "INT")
-        PushInt(stoi(Val));
-    else if (Type == "FLOAT")
-        PushFloat(stof(Val));
 }
 
 void NSBInterpreter::Assign()
 {
-    if (pContext->GetParam(0) == "__array_variable__")
+    static const uint32_t ArrayVariable = Bytecode::Intern("__array_variable__");
+    if (pContext->GetOperand(0).Str == ArrayVariable)
     {
         Params.Begin(1);
         Variable* pVar = PopVar();
         Variable* pLit = PopVar();
         pVar->Set(pLit);
-        Variable::Destroy(pLit);
     }
     else
         Assign_(0);
@@ -532,7 +748,7 @@ void NSBInterpreter::Assign()
 
 void NSBInterpreter::Get()
 {
-    PushVar(GetVar(pContext->GetParam(0)));
+    PushVar(GetVar(pContext->GetOperand(0).Str));
 }
 
 void NSBInterpreter::ScopeBegin()
@@ -595,7 +811,7 @@ void NSBInterpreter::Break()
 
 void NSBInterpreter::Jump()
 {
-    pContext->Jump(pContext->GetParam(0));
+    pContext->Jump(pContext->GetOperand(0).Int);
 }
 
 Variable* NSBInterpreter::PopVar()
@@ -605,17 +821,17 @@ Variable* NSBInterpreter::PopVar()
 
 Texture* NSBInterpreter::PopTexture()
 {
-    return Get<Texture>(PopString());
+    return Get<Texture>(Pop<NSBString>());
 }
 
 GLTexture* NSBInterpreter::PopGLTexture()
 {
-    return Get<GLTexture>(PopString());
+    return Get<GLTexture>(Pop<NSBString>());
 }
 
 Playable* NSBInterpreter::PopPlayable()
 {
-    return Get<Playable>(PopString());
+    return Get<Playable>(Pop<NSBString>());
 }
 
 Scrollbar* NSBInterpreter::PopScrollbar()
@@ -627,7 +843,6 @@ int32_t NSBInterpreter::PopInt()
 {
     Variable* pVar = PopVar();
     int32_t Val = pVar->ToInt();
-    Variable::Destroy(pVar);
     return Val;
 }
 
@@ -635,7 +850,6 @@ float NSBInterpreter::PopFloat()
 {
     Variable* pVar = PopVar();
     float Val = pVar->ToFloat();
-    Variable::Destroy(pVar);
     return Val;
 }
 
@@ -643,135 +857,201 @@ string NSBInterpreter::PopString()
 {
     Variable* pVar = PopVar();
     string Val = pVar->ToString();
-    Variable::Destroy(pVar);
     return Val;
 }
 
-NSBPosition NSBInterpreter::PopPos()
+int32_t NSBPosition::operator()(int32_t xy, int32_t Old) const
 {
-    const int32_t WIDTH = pWindow->WIDTH;
-    const int32_t HEIGHT = pWindow->HEIGHT;
-    static const size_t SPECIAL_POS_NUM = 19;
-    static const PosFunc SpecialPosTable[SPECIAL_POS_NUM] =
-    {
-        [WIDTH] (int32_t x) { return WIDTH; }, // OutRight
-        [] (int32_t x) { return -x; }, // OutLeft
-        [] (int32_t y) { return -y; }, // OutTop
-        [HEIGHT] (int32_t y) { return HEIGHT; }, // OutBottom
-
-        [WIDTH] (int32_t x) { return WIDTH - x; }, // InRight
-        [] (int32_t x) { return 0; }, // InLeft
-        [] (int32_t y) { return 0; }, // InTop
-        [HEIGHT] (int32_t y) { return HEIGHT - y; }, // InBottom
-
-        [WIDTH] (int32_t x) { return WIDTH - (x / 2); }, // OnRight
-        [] (int32_t x) { return -(x / 2); }, // OnLeft
-        [] (int32_t y) { return -(y / 2); }, // OnTop
-        [HEIGHT] (int32_t y) { return HEIGHT - (y / 2); }, // OnBottom
-
-        [] (int32_t x) { return x; }, // Right
-        [] (int32_t x) { return 0; }, // Left
-        [] (int32_t y) { return 0; }, // Top
-        [] (int32_t y) { return y; }, // Bottom
-
-        [WIDTH] (int32_t x) { return (WIDTH - x) / 2; }, // Center
-        [HEIGHT] (int32_t y) { return (HEIGHT - y) / 2; }, // Middle
-        [] (int32_t xy) { return numeric_limits<int32_t>::max(); } // Auto
-    };
-    static const string SpecialPos[SPECIAL_POS_NUM] =
+    int32_t Pos;
+    switch (Type)
     {
-        "outright", "outleft", "outtop", "outbottom",
-        "inright", "inleft", "intop", "inbottom",
-        "onright", "onleft", "ontop", "onbottom",
-        "right", "left", "top", "bottom",
-        "center", "middle", "auto"
-    };
+    case END: Pos = Value - xy; break;
+    case ON: Pos = Value - (xy / 2); break;
+    case SIZE: Pos = xy; break;
+    case CENTER: Pos = (Value - xy) / 2; break;
+    default: Pos = Value; break;
+    }
+    return Relative ? Old + Pos : Pos;
+}
+
+/*
+ * Named positions. Extent selects the screen extent kept in Value, which
+ * is read from the window each time a position is popped.
+ * */
+enum PosExtent : uint8_t
+{
+    EXTENT_NONE,
+    EXTENT_WIDTH,
+    EXTENT_HEIGHT,
+    EXTENT_UNBOUNDED
+};
+
+static const struct
+{
+    const char* pName;
+    NSBPosition::PosType Type;
+    PosExtent Extent;
+} SpecialPos[] =
+{
+    { "outright", NSBPosition::VALUE, EXTENT_WIDTH },
+    { "outleft", NSBPosition::END, EXTENT_NONE },
+    { "outtop", NSBPosition::END, EXTENT_NONE },
+    { "outbottom", NSBPosition::VALUE, EXTENT_HEIGHT },
+
+    { "inright", NSBPosition::END, EXTENT_WIDTH },
+    { "inleft", NSBPosition::VALUE, EXTENT_NONE },
+    { "intop", NSBPosition::VALUE, EXTENT_NONE },
+    { "inbottom", NSBPosition::END, EXTENT_HEIGHT },
+
+    { "onright", NSBPosition::ON, EXTENT_WIDTH },
+    { "onleft", NSBPosition::ON, EXTENT_NONE },
+    { "ontop", NSBPosition::ON, EXTENT_NONE },
+    { "onbottom", NSBPosition::ON, EXTENT_HEIGHT },
+
+    { "right", NSBPosition::SIZE, EXTENT_NONE },
+    { "left", NSBPosition::VALUE, EXTENT_NONE },
+    { "top", NSBPosition::VALUE, EXTENT_NONE },
+    { "bottom", NSBPosition::SIZE, EXTENT_NONE },
+
+    { "center", NSBPosition::CENTER, EXTENT_WIDTH },
+    { "middle", NSBPosition::CENTER, EXTENT_HEIGHT },
+    { "auto", NSBPosition::VALUE, EXTENT_UNBOUNDED }
+};
+
+static const int8_t NO_POS = -1;
+static const int8_t UNKNOWN_POS = -2;
+
+static int8_t FindPos(const string& Str)
+{
+    for (size_t i = 0; i < sizeof(SpecialPos) / sizeof(*SpecialPos); ++i)
+        if (boost::algorithm::iequals(Str, SpecialPos[i].pName))
+            return i;
+    return NO_POS;
+}
+
+// String literals are only compared against the names once
+int8_t NSBInterpreter::GetPosIndex(Variable* pVar)
+{
+    uint32_t Id = pVar->GetStringId();
+    if (Id == Variable::NO_STRING)
+        return FindPos(pVar->ToString());
 
+    if (Id >= PosIndices.size())
+        PosIndices.resize(Id + 1, UNKNOWN_POS);
+    if (PosIndices[Id] == UNKNOWN_POS)
+        PosIndices[Id] = FindPos(Bytecode::GetString(Id));
+    return PosIndices[Id];
+}
+
+NSBPosition NSBInterpreter::PopPos()
+{
     NSBPosition Position;
     Variable* pVar = PopVar();
+    Position.Type = NSBPosition::VALUE;
     Position.Relative = pVar->Relative;
+    Position.Value = 0;
     if (pVar->IsInt())
     {
-        int32_t Val = pVar->ToInt();
-        Position.Func = [Val] (int32_t) { return Val; };
+        Position.Value = pVar->ToInt();
+        return Position;
     }
-    else
+
+    int8_t Index = GetPosIndex(pVar);
+    if (Index == NO_POS)
+        return Position;
+
+    Position.Type = SpecialPos[Index].Type;
+    switch (SpecialPos[Index].Extent)
     {
-        string Str = pVar->ToString();
-        transform(Str.begin(), Str.end(), Str.begin(), ::tolower);
-        size_t i = -1;
-        while (++i < SPECIAL_POS_NUM)
-            if (Str == SpecialPos[i])
-                Position.Func = SpecialPosTable[i];
+    case EXTENT_WIDTH: Position.Value = pWindow->WIDTH; break;
+    case EXTENT_HEIGHT: Position.Value = pWindow->HEIGHT; break;
+    case EXTENT_UNBOUNDED: Position.Value = numeric_limits<int32_t>::max(); break;
+    default: break;
     }
-    Variable::Destroy(pVar);
     return Position;
 }
 
-NSBPosition NSBInterpreter::PopRelative()
+NSBRelative NSBInterpreter::PopRelative()
 {
-    NSBPosition Position;
+    NSBRelative Position;
     Variable* pVar = PopVar();
+    Position.Type = NSBPosition::VALUE;
     Position.Relative = pVar->Relative;
-    int32_t Val = pVar->ToInt();
-    Position.Func = [Val] (int32_t) { return Val; };
-    Variable::Destroy(pVar);
+    Position.Value = pVar->ToInt();
     return Position;
 }
 
+// Constants resolved at load time, if pVar holds a string literal
+static const StringConstants* GetConstants(Variable* pVar)
+{
+    uint32_t Id = pVar->GetStringId();
+    return Id == Variable::NO_STRING ? nullptr : Bytecode::GetConstants(Id);
+}
+
+// Reads the decimal digits of Int as hex digits
+static uint32_t DecimalToHex(int32_t Int)
+{
+    uint32_t Dec = Int < 0 ? -(int64_t)Int : Int;
+    uint32_t Hex = 0;
+    for (uint32_t Shift = 0; Dec; Dec /= 10, Shift += 4)
+        Hex |= (Dec % 10) << Shift;
+    return Int < 0 ? -Hex : Hex;
+}
+
 uint32_t NSBInterpreter::PopColor()
 {
-    uint32_t Color = 0;
     Variable* pVar = PopVar();
-    if (pVar->IsString())
-    {
-        string Str = boost::algorithm::to_lower_copy(pVar->ToString());
-        if (Nsb::IsValidConstant<Nsb::Color>(Str))
-            Color = Nsb::ConstantToValue<Nsb::Color>(Str);
-        else
-        {
-            size_t i = Str.find_first_of("0123456789abcdef");
-            if (i != Str.npos && Str.size() - i >= 6)
-                Color = stoi(Str.substr(i, 6), nullptr, 16) | (0xFF << 24);
-        }
-    }
-    else
-        Color = stoi(to_string(pVar->ToInt()), nullptr, 16) | (0xFF << 24);
-
-    Variable::Destroy(pVar);
-    return Color;
+    if (!pVar->IsString())
+        return DecimalToHex(pVar->ToInt()) | (0xFF << 24);
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return pConsts->Color;
+    return Bytecode::ParseColor(pVar->ToString());
 }
 
 int32_t NSBInterpreter::PopRequest()
 {
-    return Nsb::ConstantToValue<Nsb::Request>(PopString());
+    Variable* pVar = PopVar();
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return pConsts->Request;
+    return Nsb::ConstantToValue<Nsb::Request>(pVar->ToString());
 }
 
 int32_t NSBInterpreter::PopTone()
 {
-    return Nsb::ConstantToValue<Nsb::Tone>(PopString());
+    Variable* pVar = PopVar();
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return pConsts->Tone;
+    return Nsb::ConstantToValue<Nsb::Tone>(pVar->ToString());
 }
 
 int32_t NSBInterpreter::PopEffect()
 {
-    return Nsb::ConstantToValue<Nsb::Effect>(PopString());
+    Variable* pVar = PopVar();
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return pConsts->Effect;
+    return Nsb::ConstantToValue<Nsb::Effect>(pVar->ToString());
 }
 
 int32_t NSBInterpreter::PopShade()
 {
-    return Nsb::ConstantToValue<Nsb::Shade>(PopString());
+    Variable* pVar = PopVar();
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return pConsts->Shade;
+    return Nsb::ConstantToValue<Nsb::Shade>(pVar->ToString());
 }
 
-int32_t NSBInterpreter::PopTempo()
+NSBTempo NSBInterpreter::PopTempo()
 {
-    return Nsb::ConstantToValue<Nsb::Tempo>(PopString());
+    Variable* pVar = PopVar();
+    if (const StringConstants* pConsts = GetConstants(pVar))
+        return { pConsts->Tempo };
+    return { Nsb::ConstantToValue<Nsb::Tempo>(pVar->ToString()) };
 }
 
 bool NSBInterpreter::PopBool()
 {
     Variable* pVar = PopVar();
     bool ret = ToBool(pVar);
-    Variable::Destroy(pVar);
     return ret;
 }
 
@@ -785,17 +1065,30 @@ string NSBInterpreter::PopSave()
 
 void NSBInterpreter::PushFloat(float Float)
 {
-    PushVar(Variable::MakeFloat(Float));
+    Variable* pVar = Params.Temporary();
+    pVar->Set(Float);
+    PushVar(pVar);
 }
 
 void NSBInterpreter::PushInt(int32_t Int)
 {
-    PushVar(Variable::MakeInt(Int));
+    Variable* pVar = Params.Temporary();
+    pVar->Set(Int);
+    PushVar(pVar);
 }
 
 void NSBInterpreter::PushString(const string& Str)
 {
-    PushVar(Variable::MakeString(Str));
+    Variable* pVar = Params.Temporary();
+    pVar->Set(Str);
+    PushVar(pVar);
+}
+
+void NSBInterpreter::PushLiteral(uint32_t Id)
+{
+    Variable* pVar = Params.Temporary();
+    pVar->SetLiteral(Id);
+    PushVar(pVar);
 }
 
 void NSBInterpreter::PushVar(Variable* pVar)
@@ -805,7 +1098,7 @@ void NSBInterpreter::PushVar(Variable* pVar)
 
 void NSBInterpreter::Assign_(int Index)
 {
-    SetVar(pContext->GetParam(Index), PopVar());
+    SetVar(pContext->GetOperand(Index).Str, PopVar());
 }
 
 void NSBInterpreter::IntUnaryOp(function<int32_t(int32_t)> Func)
@@ -877,6 +1170,213 @@ void NSBInterpreter::Call(uint16_t Magic)
         (this->*Builtins[Magic].Func)();
 }
 
+/*
+ * Runs the current thread until the end of the statement. Handlers are
+ * looked up once per script, so the loop only indexes an array of
+ * member pointers with their parameter counts already resolved.
+ * Without a debugger the loop is instantiated with Debug = false, which
+ * leaves no debugger checks in it at all, and likewise for Profiling.
+ */
+template <bool Debug, bool Profiling> void NSBInterpreter::RunThread()
+{
+    Bytecode* pCode = nullptr;
+    const NSBFunction* pHandlers = nullptr;
+
+    while (pContext->IsRunnable() && pContext->Advance() != MAGIC_CLEAR_PARAMS)
+    {
+        if (Debug)
+            DebuggerTick();
+
+        if (pContext->GetCode() != pCode)
+        {
+            pCode = pContext->GetCode();
+            pHandlers = GetHandlers(pCode);
+        }
+
+        const NSBFunction& Handler = pHandlers[pContext->GetLineNumber()];
+        uint16_t Magic = 0;
+        uint64_t Begin = 0;
+        if (Profiling)
+        {
+            Magic = pContext->GetInstruction()->Magic;
+            Begin = GetTime();
+            if (Profile.IsSampleDue(Begin))
+                Profile.Sample(pContext, Begin);
+        }
+
+        Params.Begin(Handler.NumParams);
+        (this->*Handler.Func)();
+        ++NumInstructions;
+
+        if (Profiling)
+            Profile.Record(Magic, GetTime() - Begin);
+    }
+}
+
+const NSBInterpreter::NSBFunction* NSBInterpreter::GetHandlers(Bytecode* pCode)
+{
+    auto iter = Handlers.find(pCode);
+    if (iter != Handlers.end())
+        return iter->second.data();
+
+    vector<NSBFunction>& Bound = Handlers[pCode];
+    Bound.reserve(pCode->GetSize());
+    for (uint32_t i = 0; i < pCode->GetSize(); ++i)
+    {
+        static const NSBFunction::BuiltinFunc Supers[] =
+        {
+            nullptr,
+            &NSBInterpreter::SuperPushInt,
+            &NSBInterpreter::SuperCmpBranch,
+            &NSBInterpreter::SuperAddAssign,
+            &NSBInterpreter::SuperIncrement
+        };
+
+        Instruction* pInst = pCode->GetInstruction(i);
+        if (pInst->Super != Instruction::SUPER_NONE)
+        {
+            Bound.push_back({Supers[pInst->Super], 0});
+            continue;
+        }
+        if (pInst->Magic >= Builtins.size() || !Builtins[pInst->Magic].Func)
+        {
+            Bound.push_back({&NSBInterpreter::Nop, 0});
+            continue;
+        }
+
+        NSBFunction Func = Builtins[pInst->Magic];
+        if (Func.NumParams == NSB_VARARGS)
+            Func.NumParams = pInst->NumParams;
+        Bound.push_back(Func);
+    }
+    assert(Bound.size() == pCode->GetSize());
+    return Bound.data();
+}
+
+void NSBInterpreter::Nop()
+{
+}
+
+/*
+ * Superinstructions (see: Bytecode::Optimize). Each one behaves exactly
+ * like the sequence it replaces. When its fast path does not apply, only
+ * the first instruction of the sequence runs and the rest are dispatched
+ * as usual.
+ * */
+void NSBInterpreter::SuperPushInt()
+{
+    Instruction* pInst = pContext->GetInstruction();
+    PushInt(pContext->GetCode()->GetSuperOperand(pInst, 0).Int);
+    pContext->Skip(pInst->Length - 1);
+}
+
+void NSBInterpreter::SuperCmpBranch()
+{
+    Instruction* pInst = pContext->GetInstruction();
+    Bytecode* pCode = pContext->GetCode();
+    int32_t Lhs, Rhs;
+    if (!FetchInt(pCode->GetSuperOperand(pInst, 0), Lhs) ||
+        !FetchInt(pCode->GetSuperOperand(pInst, 1), Rhs))
+        return Call(pInst->Magic);
+
+    bool Result = false;
+    switch (pCode->GetSuperOperand(pInst, 2).Int)
+    {
+        case MAGIC_CMP_EQUAL: Result = Lhs == Rhs; break;
+        case MAGIC_CMP_NE: Result = Lhs != Rhs; break;
+        case MAGIC_CMP_LESS: Result = Lhs < Rhs; break;
+        case MAGIC_CMP_GREATER: Result = Lhs > Rhs; break;
+        case MAGIC_CMP_LE: Result = Lhs <= Rhs; break;
+        case MAGIC_CMP_GE: Result = Lhs >= Rhs; break;
+    }
+
+    uint32_t Label = pCode->GetSuperOperand(pInst, 3).Int;
+    pContext->Skip(pInst->Length - 1);
+    if (pCode->GetSuperOperand(pInst, 4).Int == MAGIC_WHILE)
+        pContext->PushBreak(Label);
+    if (!Result)
+        pContext->Jump(Label);
+}
+
+void NSBInterpreter::SuperAddAssign()
+{
+    Instruction* pInst = pContext->GetInstruction();
+    Bytecode* pCode = pContext->GetCode();
+    Variable* pLhs = Fetch(pCode->GetSuperOperand(pInst, 0));
+    Variable* pRhs = Fetch(pCode->GetSuperOperand(pInst, 1));
+    Variable* pSum = Params.Temporary();
+    if (pLhs->IsFloat() || pRhs->IsFloat())
+        pSum->Set(pLhs->ToFloat() + pRhs->ToFloat());
+    else
+        Variable::Add(pLhs, pRhs, pSum);
+    SetVar(pCode->GetSuperOperand(pInst, 2).Str, pSum);
+    pContext->Skip(pInst->Length - 1);
+}
+
+void NSBInterpreter::SuperIncrement()
+{
+    static const uint32_t SendMailNo = Bytecode::Intern("$SW_PHONE_SENDMAILNO");
+    Instruction* pInst = pContext->GetInstruction();
+    Bytecode* pCode = pContext->GetCode();
+    const Operand& Op = pCode->GetSuperOperand(pInst, 0);
+    Variable* pVar = Op.Type == Operand::VARIABLE ? GetVar(Op.Str) : VariableHolder.Read(Op.Str);
+    if (!pVar || Op.Str == SendMailNo)
+        return Call(pInst->Magic);
+
+    if (pCode->GetSuperOperand(pInst, 1).Int == MAGIC_INCREMENT)
+        pVar->IntUnaryOp([](int32_t a) { return ++a; });
+    else
+        pVar->IntUnaryOp([](int32_t a) { return --a; });
+    PushVar(pVar);
+    pContext->Skip(pInst->Length - 1);
+}
+
+/*
+ * Value which MAGIC_LITERAL or MAGIC_VARIABLE would push, if the builtins
+ * would treat it as an integer.
+ * */
+bool NSBInterpreter::FetchInt(const Operand& Op, int32_t& Val)
+{
+    Variable* pVar = nullptr;
+    switch (Op.Type)
+    {
+        case Operand::INT:
+            Val = Op.Int;
+            return true;
+        case Operand::VARIABLE:
+            pVar = GetVar(Op.Str);
+            break;
+        case Operand::STRING:
+            pVar = VariableHolder.Read(Op.Str);
+            break;
+    }
+
+    if (!pVar || !pVar->IsInt() || pVar->IsFloat())
+        return false;
+
+    Val = pVar->ToInt();
+    return true;
+}
+
+Variable* NSBInterpreter::Fetch(const Operand& Op)
+{
+    if (Op.Type == Operand::VARIABLE)
+        return GetVar(Op.Str);
+
+    if (Op.Type == Operand::STRING)
+        if (Variable* pVar = VariableHolder.Read(Op.Str))
+            return pVar;
+
+    Variable* pVar = Params.Temporary();
+    if (Op.Type == Operand::INT)
+        pVar->Set(Op.Int);
+    else if (Op.Type == Operand::FLOAT)
+        pVar->Set(Op.Float);
+    else
+        pVar->SetLiteral(Op.Str);
+    return pVar;
+}
+
 bool NSBInterpreter::SelectEvent()
 {
     if (!Events.empty())
@@ -887,8 +1387,10 @@ bool NSBInterpreter::SelectEvent()
     }
     else
     {
+        // Sleep until the next input event (see: PushEvent)
         pContext->Rewind();
-        pContext->Wait(20);
+        pContext->Wait(-1);
+        Selecting.push_back(pContext);
         return false;
     }
 }
@@ -897,13 +1399,22 @@ void NSBInterpreter::AddThread(NSBContext* pThread)
 {
     pThread->Start();
     Threads.push_back(pThread);
-    ThreadsModified = true;
+    MakeReady(pThread);
 }
 
 void NSBInterpreter::RemoveThread(NSBContext* pThread)
 {
     Threads.remove(pThread);
-    ThreadsModified = true;
+    Ready.remove(pThread);
+    Selecting.remove(pThread);
+    for (auto i = Waiters.begin(); i != Waiters.end();)
+    {
+        if (i->second == pThread)
+            i = Waiters.erase(i);
+        else
+            ++i;
+    }
+    Sleeping.erase(pThread);
 }
 
 int32_t NSBInterpreter::GetInt(const string& Name)
@@ -925,25 +1436,60 @@ string NSBInterpreter::GetString(const string& Name)
 
 bool NSBInterpreter::ToBool(Variable* pVar)
 {
-    if (pVar->IsString())
-    {
-        int32_t Val = Nsb::ConstantToValue<Nsb::Boolean>(pVar->ToString());
-        if (Val != -1)
-            return static_cast<bool>(Val);
-    }
-    return static_cast<bool>(pVar->ToInt());
+    return pVar->ToBool();
 }
 
-Variable* NSBInterpreter::GetVar(const string& Name)
+Variable* NSBInterpreter::GetVar(uint32_t Id)
 {
-    if (Variable* pVar = VariableHolder.Read(Name))
+    if (Variable* pVar = VariableHolder.Read(Id))
         return pVar;
 
-    Variable* pVar = Variable::MakeNull(Name);
-    VariableHolder.Write(Name, pVar);
+    if (Variable* pElem = ReadElement(Bytecode::GetString(Id)))
+        return pElem;
+
+    Variable* pVar = Variable::MakeNull(Bytecode::GetString(Id));
+    VariableHolder.Write(Id, pVar);
     return pVar;
 }
 
+Variable* NSBInterpreter::GetVar(const string& Name)
+{
+    return GetVar(Bytecode::Intern(Name));
+}
+
+/*
+ * Element Index of an array. Indices which do not fit into the array fall
+ * back to a plain Name/Index variable.
+ * */
+Variable* NSBInterpreter::GetElement(Variable* pArr, int32_t Index)
+{
+    if (Variable* pElem = pArr->GetElement(Index))
+        return pElem;
+    return GetVar(pArr->GetName() + "/" + to_string(Index));
+}
+
+// Resolves Name/Index paths of existing array elements
+Variable* NSBInterpreter::ReadElement(const string& Name)
+{
+    size_t Slash = Name.rfind('/');
+    if (Slash == string::npos || Slash + 1 == Name.size())
+        return nullptr;
+
+    string Parent = Name.substr(0, Slash);
+    Variable* pArr = VariableHolder.Read(Bytecode::Intern(Parent));
+    if (!pArr)
+        pArr = ReadElement(Parent);
+    if (!pArr || !pArr->GetNumElements())
+        return nullptr;
+
+    const char* pIndex = Name.c_str() + Slash + 1;
+    char* pEnd;
+    long Index = strtol(pIndex, &pEnd, 10);
+    if (*pEnd || !isdigit(*pIndex))
+        return nullptr;
+    return pArr->GetElement(Index);
+}
+
 Object* NSBInterpreter::GetObject(const string& Name)
 {
     return ObjectHolder.Read(Name);
@@ -955,45 +1501,63 @@ void NSBInterpreter::OnVariableChanged(const string& Name)
         pWindow->SetFullscreen(GetBool("#SYSTEM_window_full") ? SDL_WINDOW_FULLSCREEN : 0);
 }
 
+void NSBInterpreter::WatchVariable(const string& Name)
+{
+    VariableHolder.Watch(Bytecode::Intern(Name));
+}
+
+void NSBInterpreter::SetVar(uint32_t Id, Variable* pVar)
+{
+    GetVar(Id)->Set(pVar);
+    if (VariableHolder.IsWatched(Id))
+        OnVariableChanged(Bytecode::GetString(Id));
+}
+
 void NSBInterpreter::SetVar(const string& Name, Variable* pVar)
 {
-    GetVar(Name)->Set(pVar);
-    OnVariableChanged(Name);
-    Variable::Destroy(pVar);
+    SetVar(Bytecode::Intern(Name), pVar);
+}
+
+void NSBInterpreter::SetInt(uint32_t Id, int32_t Val)
+{
+    GetVar(Id)->Set(Val);
+    if (VariableHolder.IsWatched(Id))
+        OnVariableChanged(Bytecode::GetString(Id));
 }
 
 void NSBInterpreter::SetInt(const string& Name, int32_t Val)
 {
-    SetVar(Name, Variable::MakeInt(Val));
+    SetInt(Bytecode::Intern(Name), Val);
+}
+
+void NSBInterpreter::SetString(uint32_t Id, const string& Val)
+{
+    GetVar(Id)->Set(Val);
+    if (VariableHolder.IsWatched(Id))
+        OnVariableChanged(Bytecode::GetString(Id));
 }
 
 void NSBInterpreter::SetString(const string& Name, const string& Val)
 {
-    SetVar(Name, Variable::MakeString(Val));
+    SetString(Bytecode::Intern(Name), Val);
 }
 
 void NSBInterpreter::AddAssign()
 {
-    Variable* pVar = GetVar(pContext->GetParam(0));
-    Variable* pTemp = Variable::Add(pVar, PopVar());
-    pVar->Set(pTemp);
-    Variable::Destroy(pTemp);
+    Variable* pVar = GetVar(pContext->GetOperand(0).Str);
+    Variable::Add(pVar, PopVar(), pVar);
 }
 
 void NSBInterpreter::SubAssign()
 {
-    Variable* pVar = GetVar(pContext->GetParam(0));
-    Variable* pTemp = Variable::MakeInt(pVar->ToInt() - PopInt());
-    pVar->Set(pTemp);
-    Variable::Destroy(pTemp);
+    Variable* pVar = GetVar(pContext->GetOperand(0).Str);
+    pVar->Set(pVar->ToInt() - PopInt());
 }
 
 void NSBInterpreter::ModAssign()
 {
-    Variable* pVar = GetVar(pContext->GetParam(0));
-    Variable* pTemp = Variable::MakeInt(pVar->ToInt() % PopInt());
-    pVar->Set(pTemp);
-    Variable::Destroy(pTemp);
+    Variable* pVar = GetVar(pContext->GetOperand(0).Str);
+    pVar->Set(pVar->ToInt() % PopInt());
 }
 
 void NSBInterpreter::WriteFile()
@@ -1014,14 +1578,8 @@ void NSBInterpreter::ReadFile()
     delete[] pData;
 }
 
-void NSBInterpreter::CreateTexture()
+void NSBInterpreter::CreateTexture(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, const string& Source)
 {
-    string Handle = PopString();
-    int32_t Priority = PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    string Source = PopString();
-
     Texture* pTexture = new Texture;
     if (Source == "VIDEO")
         ;
@@ -1045,15 +1603,13 @@ void NSBInterpreter::CreateTexture()
     ObjectHolder.Write(Handle, pTexture);
 }
 
-void NSBInterpreter::ImageHorizon()
+void NSBInterpreter::ImageHorizon(Texture* pTexture)
 {
-    Texture* pTexture = PopTexture();
     PushInt(pTexture ? pTexture->GetWidth() : 0);
 }
 
-void NSBInterpreter::ImageVertical()
+void NSBInterpreter::ImageVertical(Texture* pTexture)
 {
-    Texture* pTexture = PopTexture();
     PushInt(pTexture ? pTexture->GetHeight() : 0);
 }
 
@@ -1094,18 +1650,18 @@ void NSBInterpreter::MoveCursor()
 void NSBInterpreter::Position()
 {
     Texture* pTexture = PopTexture();
-    SetInt(pContext->GetParam(1), pTexture->GetX());
-    SetInt(pContext->GetParam(2), pTexture->GetY());
+    SetInt(pContext->GetOperand(1).Str, pTexture->GetX());
+    SetInt(pContext->GetOperand(2).Str, pTexture->GetY());
 }
 
-void NSBInterpreter::Wait()
+void NSBInterpreter::Wait(int32_t Time)
 {
-    pContext->Wait(PopInt());
+    pContext->Wait(Time);
 }
 
-void NSBInterpreter::WaitKey()
+void NSBInterpreter::WaitKey(NSBOptional Time)
 {
-    pContext->WaitKey(pContext->GetNumParams() == 1 ? PopInt() : -1);
+    pContext->WaitKey(Time.Or(-1));
 }
 
 void NSBInterpreter::NegaExpression()
@@ -1140,7 +1696,6 @@ void NSBInterpreter::String()
             Fmt % pVar->ToString();
         else if (pVar->IsFloat())
             Fmt % pVar->ToFloat();
-        Variable::Destroy(pVar);
     }
     PushString(Fmt.str());
 }
@@ -1177,17 +1732,7 @@ void NSBInterpreter::CreateProcess()
 
 void NSBInterpreter::Count()
 {
-    Variable* pArr = PopVar();
-    int SCount = count(pArr->Name.begin(), pArr->Name.end(), '/') + 1;
-    int32_t Size = 0;
-    for (auto& i : VariableHolder.Cache)
-    {
-        string Prefix = i.first.substr(0, pArr->Name.size());
-        int Count = count(i.first.begin(), i.first.end(), '/');
-        if (Prefix == pArr->Name && SCount == Count)
-            Size++;
-    }
-    PushInt(Size);
+    PushInt(PopVar()->GetNumElements());
 }
 
 void NSBInterpreter::Array()
@@ -1196,27 +1741,26 @@ void NSBInterpreter::Array()
     if (!pArr)
     {
         pArr = Variable::MakeNull(pContext->GetParam(0));
-        VariableHolder.Write(pContext->GetParam(0), pArr);
+        VariableHolder.Write(pContext->GetOperand(0).Str, pArr);
     }
     for (int i = 1; i < pContext->GetNumParams(); ++i)
     {
-        string Name = pArr->Name + "/" + to_string(i - 1);
-        Variable* pVar = Variable::MakeCopy(PopVar(), Name);
-        VariableHolder.Write(Name, pVar);
+        Variable* pElem = GetElement(pArr, i - 1);
+        pElem->Relative = false;
+        pElem->Set(PopVar());
     }
 }
 
 void NSBInterpreter::SubScript()
 {
-    Variable* pArr = GetVar(pContext->GetParam(0));
-    int32_t Depth = stoi(pContext->GetParam(1));
+    Variable* pArr = GetVar(pContext->GetOperand(0).Str);
+    int32_t Depth = pContext->GetOperand(1).Int;
     Params.Begin(Depth);
     while (Depth --> 0)
     {
         Variable* pVar = PopVar();
-        int Index = pVar->IsInt() ? pVar->ToInt() : pArr->Assoc[pVar->ToString()];
-        pArr = GetVar(pArr->Name + "/" + to_string(Index));
-        Variable::Destroy(pVar);
+        int Index = pVar->IsInt() ? pVar->ToInt() : pArr->GetAssoc()[pVar->ToString()];
+        pArr = GetElement(pArr, Index);
     }
     PushVar(pArr);
 }
@@ -1225,7 +1769,7 @@ void NSBInterpreter::AssocArray()
 {
     Variable* pArr = PopVar();
     for (int i = 1; i < pContext->GetNumParams(); ++i)
-        pArr->Assoc[PopString()] = i - 1;
+        pArr->GetAssoc()[PopString()] = i - 1;
 }
 
 void NSBInterpreter::ModuleFileName()
@@ -1234,11 +1778,8 @@ void NSBInterpreter::ModuleFileName()
     PushString(Name.substr(4, Name.size() - 8)); // Remove nss/ and .nsb
 }
 
-void NSBInterpreter::Request()
+void NSBInterpreter::Request(const string& Handle, NSBRequest Request)
 {
-    string Handle = PopString();
-    int32_t Request = PopRequest();
-
     ObjectHolder.Execute(Handle, [Request] (Object** ppObject)
     {
         if (Object* pObject = *ppObject)
@@ -1246,28 +1787,17 @@ void NSBInterpreter::Request()
     });
 }
 
-void NSBInterpreter::SetVertex()
+void NSBInterpreter::SetVertex(Texture* pTexture, NSBPosition X, NSBPosition Y)
 {
-    Texture* pTexture = PopTexture();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-
     if (pTexture)
         pTexture->SetVertex(X(pTexture->GetWidth(), pTexture->GetOX()), Y(pTexture->GetHeight(), pTexture->GetOY()));
 }
 
-void NSBInterpreter::Zoom()
+void NSBInterpreter::Zoom(const string& Handle, int32_t Time, NSBRelative XScale, NSBRelative YScale, NSBTempo Tempo, bool Wait)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    NSBPosition XScale = PopRelative();
-    NSBPosition YScale = PopRelative();
-    int32_t Tempo = PopTempo();
-    bool Wait = PopBool();
-
     ObjectHolder.Execute(Handle, [&] (Object** ppObject)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
+        if (Texture* pTexture = ObjectCast<Texture>(*ppObject))
             pTexture->Zoom(Time, XScale(0, pTexture->GetXScale()), YScale(0, pTexture->GetYScale()), Tempo);
     });
 
@@ -1275,18 +1805,11 @@ void NSBInterpreter::Zoom()
         pContext->Wait(Time);
 }
 
-void NSBInterpreter::Move()
+void NSBInterpreter::Move(const string& Handle, int32_t Time, NSBPosition X, NSBPosition Y, NSBTempo Tempo, bool Wait)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    int32_t Tempo = PopTempo();
-    bool Wait = PopBool();
-
     ObjectHolder.Execute(Handle, [&] (Object** ppObject)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
+        if (Texture* pTexture = ObjectCast<Texture>(*ppObject))
             pTexture->Move(X(pTexture->GetWidth(), pTexture->GetMX()), Y(pTexture->GetHeight(), pTexture->GetMY()), Time, Tempo);
     });
 
@@ -1294,19 +1817,14 @@ void NSBInterpreter::Move()
         pContext->Wait(Time);
 }
 
-void NSBInterpreter::SetShade()
+void NSBInterpreter::SetShade(Texture* pTexture, NSBShade Shade)
 {
-    if (Texture* pTexture = PopTexture())
-        pTexture->SetShade(PopShade());
+    if (pTexture)
+        pTexture->SetShade(Shade);
 }
 
-void NSBInterpreter::DrawToTexture()
+void NSBInterpreter::DrawToTexture(GLTexture* pTexture, int32_t X, int32_t Y, const string& Filename)
 {
-    GLTexture* pTexture = PopGLTexture();
-    int32_t X = PopInt();
-    int32_t Y = PopInt();
-    string Filename = PopString();
-
     if (pTexture)
         pTexture->Draw(X, Y, Filename);
 }
@@ -1323,17 +1841,8 @@ void NSBInterpreter::CreateRenderTexture()
     ObjectHolder.Write(Handle, pTexture);
 }
 
-void NSBInterpreter::DrawTransition()
+void NSBInterpreter::DrawTransition(Texture* pTexture, int32_t Time, int32_t Start, int32_t End, int32_t Boundary, NSBTempo Tempo, const string& Filename, bool Wait)
 {
-    Texture* pTexture = PopTexture();
-    int32_t Time = PopInt();
-    int32_t Start = PopInt();
-    int32_t End = PopInt();
-    int32_t Boundary = PopInt();
-    int32_t Tempo = PopTempo();
-    string Filename = PopString();
-    bool Wait = PopBool();
-
     if (pTexture)
         pTexture->DrawTransition(Time, Start, End, Boundary, Tempo, Filename);
 
@@ -1341,16 +1850,8 @@ void NSBInterpreter::DrawTransition()
         pContext->Wait(Time);
 }
 
-void NSBInterpreter::CreateColor()
+void NSBInterpreter::CreateColor(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, int32_t Width, int32_t Height, uint32_t Color)
 {
-    string Handle = PopString();
-    int32_t Priority = PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    int32_t Width = PopInt();
-    int32_t Height = PopInt();
-    uint32_t Color = PopColor();
-
     Texture* pTexture = new Texture;
     pTexture->CreateFromColor(Width, Height, Color);
     pTexture->SetVertex(Width / 2, Height / 2);
@@ -1361,30 +1862,21 @@ void NSBInterpreter::CreateColor()
     ObjectHolder.Write(Handle, pTexture);
 }
 
-void NSBInterpreter::LoadImage()
+void NSBInterpreter::LoadImage(const string& Handle, const string& Filename)
 {
-    string Handle = PopString();
-    string Filename = PopString();
-
     Image* pImage = new Image;
     if (Filename == "SCREEN")
         pImage->LoadScreen(pWindow);
     else
-        pImage->LoadImage(Filename);
+        pImage->LoadImageAsync(Filename);
     ObjectHolder.Write(Handle, pImage);
 }
 
-void NSBInterpreter::Fade()
+void NSBInterpreter::Fade(const string& Handle, int32_t Time, int32_t Opacity, NSBTempo Tempo, bool Wait)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    int32_t Opacity = PopInt();
-    int32_t Tempo = PopTempo();
-    bool Wait = PopBool();
-
     ObjectHolder.Execute(Handle, [Time, Opacity, Tempo] (Object** ppObject)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
+        if (Texture* pTexture = ObjectCast<Texture>(*ppObject))
             pTexture->Fade(Time, Opacity, Tempo);
     });
 
@@ -1392,10 +1884,8 @@ void NSBInterpreter::Fade()
         pContext->Wait(Time);
 }
 
-void NSBInterpreter::Delete()
+void NSBInterpreter::Delete(const string& Handle)
 {
-    string Handle = PopString();
-
     ObjectHolder.Execute(Handle, [this] (Object** ppObject)
     {
         if (Object* pObject = *ppObject)
@@ -1403,7 +1893,7 @@ void NSBInterpreter::Delete()
             if (pObject->Lock)
                 return;
 
-            if (NSBContext* pThread = dynamic_cast<NSBContext*>(pObject))
+            if (NSBContext* pThread = ObjectCast<NSBContext>(pObject))
                 RemoveThread(pThread);
 
             delete pObject;
@@ -1417,42 +1907,29 @@ void NSBInterpreter::ClearParams()
     Params.Reset();
 }
 
-void NSBInterpreter::SetLoop()
+void NSBInterpreter::SetLoop(Playable* pPlayable, bool Loop)
 {
-    if (Playable* pPlayable = PopPlayable())
-        pPlayable->SetLoop(PopBool());
+    if (pPlayable)
+        pPlayable->SetLoop(Loop);
 }
 
-void NSBInterpreter::SetVolume()
+void NSBInterpreter::SetVolume(const string& Handle, int32_t Time, int32_t Volume, NSBTempo Tempo)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    int32_t Volume = PopInt();
-    int32_t Tempo = PopTempo();
-
     ObjectHolder.Execute(Handle, [Time, Volume, Tempo] (Object** ppObject)
     {
-        if (Playable* pPlayable = dynamic_cast<Playable*>(*ppObject))
+        if (Playable* pPlayable = ObjectCast<Playable>(*ppObject))
             pPlayable->SetVolume(Time, Volume, Tempo);
     });
 }
 
-void NSBInterpreter::SetLoopPoint()
+void NSBInterpreter::SetLoopPoint(Playable* pPlayable, int32_t Begin, int32_t End)
 {
-    string Handle = PopString();
-    int32_t Begin = PopInt();
-    int32_t End = PopInt();
-
-    if (Playable* pPlayable = Get<Playable>(Handle))
+    if (pPlayable)
         pPlayable->SetLoopPoint(Begin, End);
 }
 
-void NSBInterpreter::CreateSound()
+void NSBInterpreter::CreateSound(const string& Handle, const string& Type, string File)
 {
-    string Handle = PopString();
-    string Type = PopString();
-    string File = PopString();
-
     if (File.substr(File.size() - 4) != ".ogg")
         File += ".ogg";
 
@@ -1475,81 +1952,54 @@ void NSBInterpreter::CreateSound()
     ObjectHolder.Write(Handle, pPlayable);
 }
 
-void NSBInterpreter::RemainTime()
+void NSBInterpreter::RemainTime(Playable* pPlayable)
 {
-    Playable* pPlayable = PopPlayable();
     PushInt(pPlayable ? pPlayable->RemainTime() : 0);
 }
 
-void NSBInterpreter::CreateMovie()
+void NSBInterpreter::CreateMovie(const string& Handle, int32_t Priority, Variable* /*X*/, Variable* /*Y*/, bool Loop, bool Alpha, const string& File, bool Audio)
 {
-    string Handle = PopString();
-    int32_t Priority = PopInt();
-    /*NSBPosition X = */PopPos();
-    /*NSBPosition Y = */PopPos();
-    bool Loop = PopBool();
-    bool Alpha = PopBool();
-    string File = PopString();
-    bool Audio = PopBool();
-
     Movie* pMovie = new Movie(File, pWindow, Priority, Alpha, Audio);
     pMovie->SetLoop(Loop);
     pWindow->AddTexture(pMovie);
     ObjectHolder.Write(Handle, pMovie);
 }
 
-void NSBInterpreter::DurationTime()
+void NSBInterpreter::DurationTime(Playable* pPlayable)
 {
-    Playable* pPlayable = PopPlayable();
     PushInt(pPlayable ? pPlayable->DurationTime() : 0);
 }
 
-void NSBInterpreter::SetFrequency()
+void NSBInterpreter::SetFrequency(const string& Handle, int32_t Time, int32_t Frequency, NSBTempo Tempo)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    int32_t Frequency = PopInt();
-    int32_t Tempo = PopTempo();
-
     if (Playable* pPlayable = Get<Playable>(Handle))
         pPlayable->SetFrequency(Time, Frequency, Tempo);
 }
 
-void NSBInterpreter::SetPan()
+void NSBInterpreter::SetPan(const string& Handle, int32_t Time, int32_t Pan, NSBTempo Tempo)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    int32_t Pan = PopInt();
-    int32_t Tempo = PopTempo();
-
     if (Playable* pPlayable = Get<Playable>(Handle))
         pPlayable->SetPan(Time, Pan, Tempo);
 }
 
-void NSBInterpreter::SetAlias()
+void NSBInterpreter::SetAlias(const string& Handle, const string& Alias)
 {
-    string Handle = PopString();
-    string Alias = PopString();
     ObjectHolder.WriteAlias(Handle, Alias);
 }
 
-void NSBInterpreter::CreateName()
+void NSBInterpreter::CreateName(const string& Handle)
 {
-    ObjectHolder.Write(PopString(), new Name);
+    ObjectHolder.Write(Handle, new Name);
 }
 
-void NSBInterpreter::CreateWindow()
+void NSBInterpreter::CreateWindow(const string& Handle, int32_t Priority, int32_t X, int32_t Y, int32_t Width, int32_t Height, Variable* /*unk*/)
 {
-    string Handle = PopString();
-
     Window_t* pWindow = new Window_t;
-    pWindow->Priority = PopInt();
-    pWindow->X = PopInt();
-    pWindow->Y = PopInt();
-    pWindow->Width = PopInt();
-    pWindow->Height = PopInt();
-    /*bool unk = */PopBool();
-
+    pWindow->Priority = Priority;
+    pWindow->X = X;
+    pWindow->Y = Y;
+    pWindow->Width = Width;
+    pWindow->Height = Height;
     ObjectHolder.Write(Handle, pWindow);
 }
 
@@ -1580,26 +2030,23 @@ void NSBInterpreter::Case()
         pChoice->Reset();
     }
 
-    pContext->Jump(Choose ? pContext->GetParam(2) : pContext->GetParam(1));
+    pContext->Jump(pContext->GetOperand(Choose ? 2 : 1).Int);
 }
 
 void NSBInterpreter::CaseEnd()
 {
 }
 
-void NSBInterpreter::SetNextFocus()
+void NSBInterpreter::SetNextFocus(const string& First, const string& Second, const string& Key)
 {
-    Choice* pFirst = Get<Choice>(PopString());
-    Choice* pSecond = Get<Choice>(PopString());
-    string Key = PopString();
-
+    Choice* pFirst = Get<Choice>(First);
+    Choice* pSecond = Get<Choice>(Second);
     if (pFirst && pSecond)
         pFirst->SetNextFocus(pSecond, Key);
 }
 
-void NSBInterpreter::PassageTime()
+void NSBInterpreter::PassageTime(Playable* pPlayable)
 {
-    Playable* pPlayable = PopPlayable();
     PushInt(pPlayable ? pPlayable->PassageTime() : 0);
 }
 
@@ -1639,27 +2086,36 @@ void NSBInterpreter::LoadText()
     }
 }
 
-void NSBInterpreter::WaitText()
+void NSBInterpreter::WaitText(const string& Handle, int32_t Time)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-
     if (Text* pText = Get<Text>(Handle))
         if (!SkipHack)
             pContext->WaitText(pText, Time);
 }
 
-void NSBInterpreter::LockVideo()
+void NSBInterpreter::LockVideo(Variable* /*Lock*/)
+{
+}
+
+// Array elements are saved as separate Name/Index variables
+static void Flatten(const string& Name, Variable* pVar, map<string, Variable*>& Vars)
 {
-    /*bool Lock = */PopBool();
+    Vars[Name] = pVar;
+    for (Variable* pElem : pVar->GetElements())
+        if (pElem)
+            Flatten(pElem->GetName(), pElem, Vars);
 }
 
 void NSBInterpreter::Save()
 {
+    map<string, Variable*> Vars;
+    for (auto& var : VariableHolder.Cache)
+        Flatten(var.first, var.second, Vars);
+
     Npa::Buffer SaveData;
-    SaveData.Write<uint32_t>(VariableHolder.Cache.size());
+    SaveData.Write<uint32_t>(Vars.size());
     vector<pair<string, Variable*> > Arrays;
-    for (auto& var : VariableHolder.Cache)
+    for (auto& var : Vars)
     {
         if (var.first.front() == '#')
             continue;
@@ -1672,15 +2128,15 @@ void NSBInterpreter::Save()
         SaveData.WriteStr32(NpaFile::FromUtf8(var.second->IsString() ? var.second->ToString() : ""));
         SaveData.Write<bool>(0); // unk - maybe bool? 4?
         SaveData.WriteStr32(NpaFile::FromUtf8("")); // TODO: arrayref?
-        if (!var.second->Assoc.empty())
+        if (var.second->HasAssoc())
             Arrays.push_back(var);
     }
     SaveData.Write<uint32_t>(Arrays.size());
     for (auto& arr : Arrays)
     {
         SaveData.WriteStr32(NpaFile::FromUtf8(arr.first));
-        SaveData.Write<uint32_t>(arr.second->Assoc.size());
-        for (auto& i : arr.second->Assoc)
+        SaveData.Write<uint32_t>(arr.second->GetAssoc().size());
+        for (auto& i : arr.second->GetAssoc())
             SaveData.WriteStr32(NpaFile::ToUtf8(i.first));
     }
     fs::WriteFile(PopSave(), NpaFile::Encrypt(SaveData.GetData(), SaveData.GetSize()), SaveData.GetSize());
@@ -1729,18 +2185,8 @@ void NSBInterpreter::SetShortcut()
     Shortcuts.push_back({SDLK_a + Key[0] - 'A', Script});
 }
 
-void NSBInterpreter::CreateClipTexture()
+void NSBInterpreter::CreateClipTexture(const string& Handle, int32_t Priority, NSBPosition X1, NSBPosition Y1, int32_t X2, int32_t Y2, int32_t Width, int32_t Height, const string& Source)
 {
-    string Handle = PopString();
-    int32_t Priority = PopInt();
-    NSBPosition X1 = PopPos();
-    NSBPosition Y1 = PopPos();
-    int32_t X2 = PopInt();
-    int32_t Y2 = PopInt();
-    int32_t Width = PopInt();
-    int32_t Height = PopInt();
-    string Source = PopString();
-
     Texture* pTexture = new Texture;
     if (Source.size() < 4 || Source[Source.size() - 4] != '.')
         pTexture->CreateFromImageClip(Get<Image>(Source), X2, Y2, Width, Height);
@@ -1759,13 +2205,10 @@ void NSBInterpreter::ExistSave()
     PushInt(fs::Exists(PopSave()));
 }
 
-void NSBInterpreter::WaitAction()
+void NSBInterpreter::WaitAction(const string& Handle, NSBOptional Time)
 {
-    string Handle = PopString();
-    int32_t Time = pContext->GetNumParams() == 2 ? PopInt() : -1;
-
     if (Object* pObject = GetObject(Handle))
-        pContext->WaitAction(pObject, Time);
+        pContext->WaitAction(pObject, Time.Or(-1));
 }
 
 void NSBInterpreter::Load()
@@ -1803,20 +2246,12 @@ void NSBInterpreter::SetBacklog()
     /*string Voice = */PopString();
 
     // [WORKAROUND] In JAST the third parameter may be an integer
-    Variable::Destroy(PopVar());
+    PopVar();
     ///*string Name = */PopString();
 }
 
-void NSBInterpreter::CreateText()
+void NSBInterpreter::CreateText(const string& Handle, int32_t Priority, NSBPosition X, NSBPosition Y, NSBPosition Width, NSBPosition /*Height*/, const string& String)
 {
-    string Handle = PopString();
-    int32_t Priority = PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    NSBPosition Width = PopPos();
-    /*NSBPosition Height = */PopPos();
-    string String = PopString();
-
     Text* pText = new Text;
     pText->SetWrap(Width(0));
     pText->CreateFromString(String);
@@ -1839,21 +2274,14 @@ void NSBInterpreter::Random()
     PushInt(random() % PopInt());
 }
 
-void NSBInterpreter::CreateEffect()
+void NSBInterpreter::CreateEffect(const string& /*Handle*/, Variable* /*Priority*/, NSBPosition /*X*/, NSBPosition /*Y*/, Variable* /*Width*/, Variable* /*Height*/, Variable* /*Effect*/)
 {
-    string Handle = PopString();
-    /*int32_t Priority = */PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    /*int32_t Width = */PopInt();
-    /*int32_t Height = */PopInt();
-    /*int32_t Effect = */PopEffect();
 }
 
-void NSBInterpreter::SetTone()
+void NSBInterpreter::SetTone(Texture* pTexture, NSBTone Tone)
 {
-    if (Texture* pTexture = PopTexture())
-        pTexture->SetTone(PopTone());
+    if (pTexture)
+        pTexture->SetTone(Tone);
 }
 
 void NSBInterpreter::DateTime()
@@ -1868,21 +2296,11 @@ void NSBInterpreter::DateTime()
     PopVar()->Set(tms->tm_sec);
 }
 
-void NSBInterpreter::Shake()
+void NSBInterpreter::Shake(const string& Handle, int32_t Time, int32_t XWidth, int32_t YWidth, Variable* /*unk1*/, Variable* /*unk2*/, Variable* /*unk3*/, Variable* /*Tempo*/, bool Wait)
 {
-    string Handle = PopString();
-    int32_t Time = PopInt();
-    int32_t XWidth = PopInt();
-    int32_t YWidth = PopInt();
-    /*int32_t unk1 = */PopInt();
-    /*int32_t unk2 = */PopInt();
-    /*int32_t unk3 = */PopInt();
-    /*int32_t Tempo = */PopTempo();
-    bool Wait = PopBool();
-
     ObjectHolder.Execute(Handle, [Time, XWidth, YWidth] (Object** ppObject)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
+        if (Texture* pTexture = ObjectCast<Texture>(*ppObject))
             pTexture->Shake(XWidth, YWidth, Time);
     });
 
@@ -1890,53 +2308,32 @@ void NSBInterpreter::Shake()
         pContext->Wait(Time);
 }
 
-void NSBInterpreter::MoviePlay()
+void NSBInterpreter::MoviePlay(Variable* /*File*/, Variable* /*unk*/)
 {
-    string File = PopString();
-    /*bool unk = */PopBool();
 }
 
-void NSBInterpreter::SetStream()
+void NSBInterpreter::SetStream(Variable* /*Handle*/, Variable* /*unk*/)
 {
-    string Handle = PopString();
-    /*int32_t unk = */PopInt();
 }
 
-void NSBInterpreter::WaitPlay()
+void NSBInterpreter::WaitPlay(Playable* pPlayable, Variable* /*unk*/)
 {
-    Playable* pPlayable = PopPlayable();
-    /*string unk = */PopString();
-
-    pContext->Wait(pPlayable->RemainTime());
+    pContext->WaitAction(pPlayable, pPlayable->RemainTime());
 }
 
-void NSBInterpreter::WaitFade()
+void NSBInterpreter::WaitFade(Texture* pTexture, Variable* /*unk*/)
 {
-    Texture* pTexture = PopTexture();
-    /*string unk = */PopString();
-
     pContext->Wait(pTexture->RemainFade());
 }
 
-void NSBInterpreter::SoundAmplitude()
+void NSBInterpreter::SoundAmplitude(Variable* /*Handle*/, Variable* /*unk*/)
 {
-    string Handle = PopString();
-    /*string unk = */PopString();
-
     // [HACK]
     PushInt(0);
 }
 
-void NSBInterpreter::Rotate()
+void NSBInterpreter::Rotate(Texture* pTexture, int32_t Time, Variable* /*X*/, Variable* /*Y*/, NSBRelative Z, NSBTempo Tempo, bool Wait)
 {
-    Texture* pTexture = PopTexture();
-    int32_t Time = PopInt();
-    /*NSBPosition X = */PopRelative();
-    /*NSBPosition Y = */PopRelative();
-    NSBPosition Z = PopRelative();
-    int32_t Tempo = PopTempo();
-    bool Wait = PopBool();
-
     pTexture->Rotate(Z(0, pTexture->GetAngle()), Time, Tempo);
     if (Wait)
         pContext->Wait(Time);
@@ -2058,29 +2455,14 @@ void NSBInterpreter::ScrollbarValue()
     PushInt(pScrollbar->GetValue());
 }
 
-void NSBInterpreter::CreateStencil()
+void NSBInterpreter::CreateStencil(const string& Handle, Variable* /*unk1*/, NSBPosition /*X*/, NSBPosition /*Y*/, Variable* /*unk2*/, const string& /*Filename*/, Variable* /*unk3*/)
 {
-    string Handle = PopString();
-    /*int32_t unk = */PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    /*int32_t unk = */PopInt();
-    string Filename = PopString();
-    /*bool unk = */PopBool(); // Maybe Inheritance?
-
     // Hack
     ObjectHolder.Write(Handle, new Name);
 }
 
-void NSBInterpreter::CreateMask()
+void NSBInterpreter::CreateMask(const string& Handle, Variable* /*Priority*/, NSBPosition /*X*/, NSBPosition /*Y*/, const string& /*Filename*/, Variable* /*Inheritance*/)
 {
-    string Handle = PopString();
-    /*int32_t Priority = */PopInt();
-    NSBPosition X = PopPos();
-    NSBPosition Y = PopPos();
-    string Filename = PopString();
-    /*bool Inheritance = */PopBool();
-
     // Hack
     ObjectHolder.Write(Handle, new Name);
 }
@@ -0,0 +1,180 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Object.hpp"
+
+static const uint32_t NO_NODE = UINT32_MAX;
+static const size_t MAX_NODES = 1 << 14;
+
+deque<ObjectHolder_t::HandleNode> ObjectHolder_t::Nodes;
+unordered_map<string, uint32_t> ObjectHolder_t::NodeIds;
+map<string, string> ObjectHolder_t::Aliases;
+uint32_t ObjectHolder_t::AliasGeneration = 1;
+
+ObjectHolder_t::~ObjectHolder_t()
+{
+    if (!pChildren)
+        return;
+
+    for (auto& i : *pChildren)
+        delete i.second;
+    delete pChildren;
+}
+
+// Does nothing if the parent of Handle does not exist
+void ObjectHolder_t::Write(const string& Handle, Object* pObject)
+{
+    uint32_t Node = Resolve(Intern(Handle));
+    ObjectHolder_t* pHolder = GetHolder(Node);
+    if (!pHolder)
+        return;
+
+    if (Object** ppObject = pHolder->ReadChild(Nodes[Node].Segment))
+    {
+        delete *ppObject;
+        *ppObject = pObject;
+    }
+    else if (pObject)
+    {
+        if (!pHolder->pChildren)
+            pHolder->pChildren = new map<string, Object*>;
+        (*pHolder->pChildren)[Nodes[Node].Segment] = pObject;
+    }
+}
+
+void ObjectHolder_t::WriteAlias(const string& Handle, const string& Alias)
+{
+    Aliases[Alias] = Handle;
+    AliasGeneration++;
+}
+
+string ObjectHolder_t::ExtractObjHandle(string& Handle)
+{
+    // Name
+    string ObjHandle;
+    size_t Index = Handle.find('/');
+    if (Index != string::npos)
+    {
+        ObjHandle = Handle.substr(0, Index);
+        Handle = Handle.substr(Index + 1);
+    }
+    else
+    {
+        ObjHandle = Handle;
+        Handle.clear();
+    }
+    // Alias
+    if (ObjHandle.front() == '@' && ObjHandle.back() != '*')
+    {
+        auto iter = Aliases.find(ObjHandle.substr(1));
+        Handle = (iter != Aliases.end() ? iter->second : "") + "/" + Handle;
+        ObjHandle = ExtractObjHandle(Handle);
+    }
+    return ObjHandle;
+}
+
+ObjectHolder_t* ObjectHolder_t::GetHolder(const string& Handle)
+{
+    Object** ppObject = ReadChild(Handle);
+    return ppObject ? *ppObject : nullptr;
+}
+
+// Holder which owns the last segment of Node
+ObjectHolder_t* ObjectHolder_t::GetHolder(uint32_t Node)
+{
+    uint32_t Parent = Nodes[Node].Parent;
+    if (Parent == NO_NODE)
+        return this;
+
+    Object** ppParent = ReadPointer(Parent);
+    return ppParent ? *ppParent : nullptr;
+}
+
+Object** ObjectHolder_t::ReadChild(const string& Segment)
+{
+    if (!pChildren)
+        return nullptr;
+
+    auto iter = pChildren->find(Segment);
+    if (iter != pChildren->end())
+        return &iter->second;
+    return nullptr;
+}
+
+Object** ObjectHolder_t::ReadPointer(uint32_t Node)
+{
+    if (ObjectHolder_t* pHolder = GetHolder(Node))
+        return pHolder->ReadChild(Nodes[Node].Segment);
+    return nullptr;
+}
+
+uint32_t ObjectHolder_t::Intern(const string& Handle)
+{
+    auto iter = NodeIds.find(Handle);
+    if (iter != NodeIds.end())
+        return iter->second;
+
+    HandleNode Node;
+    size_t Index = Handle.rfind('/');
+    Node.Path = Handle;
+    Node.Segment = Index == string::npos ? Handle : Handle.substr(Index + 1);
+    Node.Parent = Index == string::npos ? NO_NODE : Intern(Handle.substr(0, Index));
+    Node.Resolved = NO_NODE;
+    Node.Generation = 0;
+    Node.Wildcard = (!Node.Segment.empty() && Node.Segment.back() == '*') ||
+        (Node.Parent != NO_NODE && Nodes[Node.Parent].Wildcard);
+
+    uint32_t Id = Nodes.size();
+    Nodes.push_back(Node);
+    NodeIds[Handle] = Id;
+    return Id;
+}
+
+// Forgets every interned handle once the table is full. Live handles are
+// interned again on their next use.
+void ObjectHolder_t::Trim()
+{
+    if (Nodes.size() <= MAX_NODES)
+        return;
+
+    Nodes.clear();
+    NodeIds.clear();
+}
+
+// Expands an alias in the first segment of Node
+uint32_t ObjectHolder_t::Resolve(uint32_t Node)
+{
+    if (Nodes[Node].Generation == AliasGeneration)
+        return Nodes[Node].Resolved;
+
+    uint32_t Resolved = Node;
+    const string& Path = Nodes[Node].Path;
+    size_t Index = Path.find('/');
+    string First = Path.substr(0, Index);
+    if (!First.empty() && First.front() == '@' && First.back() != '*')
+    {
+        auto iter = Aliases.find(First.substr(1));
+        string Target = iter != Aliases.end() ? iter->second : "";
+        if (Index != string::npos)
+            Target += Path.substr(Index);
+        Resolved = Resolve(Intern(Target));
+    }
+
+    Nodes[Node].Resolved = Resolved;
+    Nodes[Node].Generation = AliasGeneration;
+    return Resolved;
+}
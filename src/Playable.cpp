@@ -17,6 +17,7 @@
  * */
 #include "Movie.hpp"
 #include "nsbconstants.hpp"
+#include "Tracer.hpp"
 #include <gst/video/videooverlay.h>
 #include <thread>
 
@@ -96,6 +97,8 @@ AudioBin(nullptr),
 Begin(0),
 End(0)
 {
+    Types |= TYPE;
+    pPlayable = this;
     GstElement* Filesrc = gst_element_factory_make("filesrc", nullptr);
     if (!Filesrc)
         cerr << "Failed to create filesrc" << endl;
@@ -109,6 +112,8 @@ Appsrc(new AppSrc(Res)),
 Loop(false),
 Begin(0)
 {
+    Types |= TYPE;
+    pPlayable = this;
     InitPipeline((GstElement*)Appsrc->Appsrc);
     InitAudio();
 }
@@ -201,10 +206,12 @@ void Playable::SetLoop(bool Loop)
 void Playable::Stop()
 {
     gst_element_set_state(Pipeline, GST_STATE_NULL);
+    Signal();
 }
 
 void Playable::Play()
 {
+    TraceScope Trace("Play", "media");
     GstStateChangeReturn ret = gst_element_set_state(Pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_ASYNC)
         ret = gst_element_get_state(Pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE);
@@ -239,6 +246,8 @@ void Playable::OnEOS()
 {
     if (Loop)
         thread([this](){Play();}).detach();
+    else
+        Signal();
 }
 
 void Playable::Request(int32_t State)
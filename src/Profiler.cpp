@@ -0,0 +1,121 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Profiler.hpp"
+#include "NSBContext.hpp"
+#include "Bytecode.hpp"
+#include "scriptfile.hpp"
+#include "nsbmagic.hpp"
+#include <algorithm>
+
+Profiler::Profiler() : Running(false), Interval(0), NextSample(0), NumSamples(0)
+{
+}
+
+// Discards the previous results
+void Profiler::Start(uint64_t Interval)
+{
+    lock_guard<mutex> Guard(Lock);
+    this->Interval = Interval;
+    NextSample = 0;
+    NumSamples = 0;
+    Builtins.clear();
+    Folded.clear();
+    Running = true;
+}
+
+void Profiler::Stop()
+{
+    Running = false;
+}
+
+void Profiler::Sample(NSBContext* pThread, uint64_t Now)
+{
+    pThread->GetTrace(Frames);
+    if (Frames.empty())
+        return;
+
+    lock_guard<mutex> Guard(Lock);
+    string Stack = pThread->GetName();
+    for (auto i = Frames.rbegin(); i != Frames.rend(); ++i)
+        Stack += ";" + i->first->GetScript()->GetName() + ":" + GetFunction(i->first, i->second);
+    Stack += ":" + to_string(Frames.front().second);
+
+    ++Folded[Stack];
+    ++NumSamples;
+    NextSample = Now + Interval;
+}
+
+void Profiler::Record(uint16_t Magic, uint64_t Time)
+{
+    lock_guard<mutex> Guard(Lock);
+    if (Magic >= Builtins.size())
+        Builtins.resize(Magic + 1, {0, 0});
+    Builtins[Magic].Calls++;
+    Builtins[Magic].Time += Time;
+}
+
+// Builtins by cumulative time
+void Profiler::WriteReport(ostream& Stream)
+{
+    lock_guard<mutex> Guard(Lock);
+    vector<uint16_t> Order;
+    for (uint16_t i = 0; i < Builtins.size(); ++i)
+        if (Builtins[i].Calls)
+            Order.push_back(i);
+
+    sort(Order.begin(), Order.end(), [this] (uint16_t a, uint16_t b)
+    {
+        return Builtins[a].Time > Builtins[b].Time;
+    });
+
+    Stream << "Magic\tCalls\tTime (us)\tAverage (us)\n";
+    for (uint16_t Magic : Order)
+    {
+        const BuiltinStats& Stats = Builtins[Magic];
+        Stream << Magic << "\t" << Stats.Calls << "\t" << Stats.Time << "\t"
+               << double(Stats.Time) / Stats.Calls << "\n";
+    }
+    Stream << NumSamples << " stack samples" << endl;
+}
+
+void Profiler::WriteFolded(ostream& Stream)
+{
+    lock_guard<mutex> Guard(Lock);
+    for (auto& i : Folded)
+        Stream << i.first << " " << i.second << "\n";
+}
+
+const string& Profiler::GetFunction(Bytecode* pCode, uint32_t CodeLine)
+{
+    static const string Unknown = "?";
+    vector<uint32_t>& Names = Functions[pCode];
+    if (Names.empty())
+    {
+        // Lines belong to the closest preceding function declaration
+        uint32_t Name = Bytecode::Intern(Unknown);
+        Names.resize(pCode->GetSize());
+        for (uint32_t i = 0; i < pCode->GetSize(); ++i)
+        {
+            Instruction* pInst = pCode->GetInstruction(i);
+            if (pInst->Magic == MAGIC_FUNCTION_DECLARATION && pInst->NumParams > 0)
+                Name = pCode->GetOperand(pInst, 0).Str;
+            Names[i] = Name;
+        }
+    }
+    return CodeLine < Names.size() ? Bytecode::GetString(Names[CodeLine]) : Unknown;
+}
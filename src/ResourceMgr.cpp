@@ -16,45 +16,74 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
 #include "ResourceMgr.hpp"
+#include "Bytecode.hpp"
 #include "scriptfile.hpp"
+#include "nsbmagic.hpp"
 #include <glib.h>
 
+/*
+ * Archives share one file handle for all their reads, which may come
+ * from the ImagePool workers and from the GStreamer streaming threads.
+ * */
+static mutex ArchiveLock;
+
 char* Resource::ReadData(uint32_t Offset, uint32_t Size)
 {
+    lock_guard<mutex> Lock(ArchiveLock);
     return pArchive->ReadData(File, Offset, Size, g_malloc);
 }
 
+char* Resource::ReadFile(uint32_t& Size)
+{
+    Size = GetSize();
+    lock_guard<mutex> Lock(ArchiveLock);
+    return pArchive->ReadData(File, 0, Size);
+}
+
 ResourceMgr* sResourceMgr;
 
-ResourceMgr::ResourceMgr()
+ResourceMgr::ResourceMgr() : Generation(1), IndexedArchives(0)
 {
 }
 
 ResourceMgr::~ResourceMgr()
 {
     for_each(Archives.begin(), Archives.end(), default_delete<INpaFile>());
+    for (auto& i : Bytecodes)
+        delete i.second;
+}
+
+void ResourceMgr::IndexArchives()
+{
+    Index.clear();
+    ReportedMisses.clear();
+    for (INpaFile* pArchive : Archives)
+        for (auto File = pArchive->Begin(); File != pArchive->End(); ++File)
+            Index.emplace(pArchive->GetFileName(File), Resource(pArchive, File));
+    IndexedArchives = Archives.size();
 }
 
 Resource ResourceMgr::GetResource(string Path)
 {
-    transform(Path.begin(), Path.end(), Path.begin(), ::tolower);
-    for (uint32_t i = 0; i < Archives.size(); ++i)
-    {
-        auto File = Archives[i]->FindFile(Path);
-        if (File != Archives[i]->End())
-            return Resource(Archives[i], File);
-    }
-    return Resource(nullptr, Archives[0]->End());
+    lock_guard<mutex> Lock(IndexLock);
+    if (IndexedArchives != Archives.size())
+        IndexArchives();
+
+    auto iter = Index.find(Path);
+    if (iter != Index.end())
+        return iter->second;
+    return Resource();
 }
 
 char* ResourceMgr::Read(string Path, uint32_t& Size)
 {
-    transform(Path.begin(), Path.end(), Path.begin(), ::tolower);
-    for (uint32_t i = 0; i < Archives.size(); ++i)
-        if (char* pData = Archives[i]->ReadFile(Path, Size))
-            return pData;
+    Resource Res = GetResource(Path);
+    if (Res.IsValid())
+        return Res.ReadFile(Size);
 
-    cout << "Failed to read " << Path << endl;
+    lock_guard<mutex> Lock(IndexLock);
+    if (ReportedMisses.insert(Path).second)
+        cout << "Failed to read " << Path << endl;
     Size = 0;
     return nullptr;
 }
@@ -68,20 +97,79 @@ ScriptFile* ResourceMgr::GetScriptFile(const string& Path)
     if (!pScript)
         return nullptr;
 
-    for (const string& i : pScript->GetIncludes())
-        GetScriptFile(i);
-
     CacheHolder.Write(Path, pScript);
+    IndexSymbols(pScript);
+    Generation++;
     return pScript;
 }
 
-ScriptFile* ResourceMgr::ResolveSymbol(const string& Symbol, uint32_t& CodeLine)
+void ResourceMgr::IndexSymbols(ScriptFile* pScript)
 {
-    for (auto& i : CacheHolder.Cache)
+    Bytecode* pCode = GetBytecode(pScript);
+    for (uint32_t i = 0; i < pCode->GetSize(); ++i)
     {
-        CodeLine = i.second->GetSymbol(Symbol);
+        Instruction* pInst = pCode->GetInstruction(i);
+        if (pInst->Magic != MAGIC_FUNCTION_DECLARATION || pInst->NumParams == 0)
+            continue;
+
+        string Symbol = Bytecode::GetString(pCode->GetOperand(pInst, 0).Str);
+        if (Symbol.compare(0, 9, "function.") != 0)
+            Symbol = "function." + Symbol;
+
+        uint32_t CodeLine = pScript->GetSymbol(Symbol);
         if (CodeLine != NSB_INVALIDE_LINE)
-            return i.second;
+            Symbols.insert(make_pair(Symbol, make_pair(pScript, CodeLine)));
+    }
+}
+
+Bytecode* ResourceMgr::GetBytecode(ScriptFile* pScript)
+{
+    auto iter = Bytecodes.find(pScript);
+    if (iter != Bytecodes.end())
+        return iter->second;
+
+    Bytecode* pCode = new Bytecode(pScript);
+    Bytecodes[pScript] = pCode;
+    return pCode;
+}
+
+/*
+ * Loaded scripts are a single lookup in Symbols. On a miss the includes
+ * reachable from the caller are read one at a time, breadth first, until
+ * the symbol shows up. Each caller keeps its walk, so its include graph
+ * is walked at most once however many lookups miss.
+ * */
+ScriptFile* ResourceMgr::ResolveSymbol(ScriptFile* pCaller, const string& Symbol, uint32_t& CodeLine)
+{
+    auto Inserted = Walks.emplace(pCaller, IncludeWalk());
+    IncludeWalk& Walk = Inserted.first->second;
+    if (Inserted.second)
+        Walk.Enqueue(pCaller);
+
+    while (true)
+    {
+        auto iter = Symbols.find(Symbol);
+        if (iter != Symbols.end())
+        {
+            CodeLine = iter->second.second;
+            return iter->second.first;
+        }
+
+        if (Walk.Pending.empty())
+            break;
+
+        string Path = Walk.Pending.front();
+        Walk.Pending.pop_front();
+        if (ScriptFile* pScript = GetScriptFile(Path))
+            Walk.Enqueue(pScript);
     }
+    CodeLine = NSB_INVALIDE_LINE;
     return nullptr;
 }
+
+void ResourceMgr::IncludeWalk::Enqueue(ScriptFile* pScript)
+{
+    for (const string& i : pScript->GetIncludes())
+        if (Seen.insert(i).second)
+            Pending.push_back(i);
+}
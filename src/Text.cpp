@@ -58,6 +58,7 @@ private:
 
 Text::Text() : Index(0), LayoutWidth(-1), Size(dSize), Color(dInColor)
 {
+    Types |= TYPE;
 }
 
 Text::~Text()
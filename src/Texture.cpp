@@ -30,8 +30,10 @@ pTone(nullptr),
 X(0), Y(0), OX(0), OY(0),
 Angle(0),
 XScale(1000), YScale(1000),
-XShake(0), YShake(0), ShakeTime(0), ShakeTick(false)
+XShake(0), YShake(0), ShakeTime(0), ShakeTick(false),
+Animating(false)
 {
+    Types |= TYPE;
 }
 
 Texture::~Texture()
@@ -63,9 +65,8 @@ void Texture::Request(int32_t State)
 
 void Texture::CreateFromGLTexture(GLTexture* pTexture)
 {
-    GLTextureID = pTexture->GLTextureID;
-    Width = pTexture->Width;
-    Height = pTexture->Height;
+    if (pTexture->pData)
+        Share(pTexture->pData);
 }
 
 void Texture::SetPosition(int X, int Y)
@@ -181,6 +182,11 @@ void Texture::Draw(uint32_t Diff)
     ShakeTime = max(0, ShakeTime - (int32_t)Diff);
     ShakeTick = ShakeTime ? !ShakeTick : false;
 
+    bool WasAnimating = Animating;
+    Animating = IsAnimating();
+    if (WasAnimating && !Animating)
+        Signal();
+
     float sx = XScale / 1000.f;
     float sy = YScale / 1000.f;
     float ox = OX * (1.f - sx);
@@ -208,6 +214,21 @@ void Texture::Draw(uint32_t Diff)
         glUseProgramObjectARB(0);
 }
 
+bool Texture::IsAnimating()
+{
+    return ShakeTime > 0 ||
+           (pMove && !pMove->IsDone()) ||
+           (pRotate && !pRotate->IsDone()) ||
+           (pZoom && !pZoom->IsDone()) ||
+           (pFade && !pFade->IsDone()) ||
+           (pMask && !pMask->IsDone());
+}
+
+bool Texture::Action()
+{
+    return !IsAnimating();
+}
+
 int32_t Texture::GetMX()
 {
     return pMove ? pMove->EndX : 0;
@@ -0,0 +1,113 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "TextureCache.hpp"
+#include "Image.hpp"
+
+map<TextureCache::Key, TextureCache::Entry> TextureCache::Entries;
+TextureCache::ReleasedList TextureCache::Released;
+size_t TextureCache::ReleasedBytes = 0;
+
+static size_t GetBytes(const TextureData* pData)
+{
+    return (size_t)pData->Width * pData->Height * 4;
+}
+
+TextureRef TextureCache::Get(const string& Filename, bool Mask, int ClipX, int ClipY, int ClipWidth, int ClipHeight)
+{
+    Key CacheKey(Filename, Mask, ClipX, ClipY, ClipWidth, ClipHeight);
+    auto iter = Entries.find(CacheKey);
+    if (iter != Entries.end())
+    {
+        if (TextureRef pData = iter->second.pData.lock())
+            return pData;
+
+        // Shown again, so it no longer counts against the budget
+        auto Node = iter->second.Released;
+        TextureData* pData = Node->second.release();
+        ReleasedBytes -= GetBytes(pData);
+        Released.erase(Node);
+        return Adopt(CacheKey, pData);
+    }
+
+    TextureData* pData = new TextureData;
+    pData->Cached = true;
+    pData->pPending.reset(new Image);
+    pData->pPending->LoadImageAsync(Filename, Mask);
+    if (ClipX == -1)
+    {
+        pData->Width = pData->pPending->GetWidth();
+        pData->Height = pData->pPending->GetHeight();
+    }
+    else
+    {
+        pData->ClipX = ClipX;
+        pData->ClipY = ClipY;
+        pData->Width = ClipWidth;
+        pData->Height = ClipHeight;
+    }
+    return Adopt(CacheKey, pData);
+}
+
+// Hands out pData, which comes back through Release once its users are gone
+TextureRef TextureCache::Adopt(const Key& CacheKey, TextureData* pData)
+{
+    TextureRef pShared(pData, [CacheKey](TextureData* pData)
+    {
+        TextureCache::Release(CacheKey, pData);
+    });
+    Entries[CacheKey] = {pShared, Released.end()};
+    return pShared;
+}
+
+void TextureCache::Release(const Key& CacheKey, TextureData* pData)
+{
+    // Not cached anymore (see: Clear)
+    auto iter = Entries.find(CacheKey);
+    if (iter == Entries.end() || iter->second.Released != Released.end())
+    {
+        delete pData;
+        return;
+    }
+
+    Released.emplace_front(CacheKey, unique_ptr<TextureData>(pData));
+    ReleasedBytes += GetBytes(pData);
+    iter->second.Released = Released.begin();
+    Trim();
+}
+
+/*
+ * Evicts the least recently released textures over the budget, along
+ * with their entries, so no entry outlives its texture.
+ * */
+void TextureCache::Trim()
+{
+    while (ReleasedBytes > RETAIN_BYTES && !Released.empty())
+    {
+        auto& Old = Released.back();
+        ReleasedBytes -= GetBytes(Old.second.get());
+        Entries.erase(Old.first);
+        Released.pop_back();
+    }
+}
+
+void TextureCache::Clear()
+{
+    Released.clear();
+    Entries.clear();
+    ReleasedBytes = 0;
+}
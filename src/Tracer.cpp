@@ -0,0 +1,203 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Tracer.hpp"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <vector>
+
+/*
+ * Only the owning thread writes Events, as a ring of its latest CAPACITY
+ * events, and publishes them by storing Head. Flush copies the ring and
+ * then discards the slots which the owner may have overwritten meanwhile.
+ * */
+struct TraceBuffer
+{
+    struct Event
+    {
+        char Name[48];
+        const char* pCategory;
+        uint64_t Begin;
+        uint64_t Duration;
+    };
+
+    static const uint32_t CAPACITY = 1 << 15;
+
+    TraceBuffer() : Id(0), Head(0), InUse(false)
+    {
+    }
+
+    uint32_t Id;
+    atomic<uint64_t> Head;
+    bool InUse;
+    Event Events[CAPACITY];
+};
+
+atomic<bool> Tracer::Enabled(false);
+static mutex BuffersLock;
+static vector<unique_ptr<TraceBuffer>> Buffers;
+static uint32_t NextId = 1;
+static string TraceFilename;
+
+// Buffers of exited threads are reused, their events are kept until then
+static TraceBuffer* AcquireBuffer()
+{
+    lock_guard<mutex> Guard(BuffersLock);
+    TraceBuffer* pBuffer = nullptr;
+    for (auto& pFree : Buffers)
+    {
+        if (!pFree->InUse)
+        {
+            pBuffer = pFree.get();
+            break;
+        }
+    }
+    if (!pBuffer)
+    {
+        pBuffer = new TraceBuffer;
+        Buffers.emplace_back(pBuffer);
+    }
+    pBuffer->Id = NextId++;
+    pBuffer->Head.store(0, memory_order_relaxed);
+    pBuffer->InUse = true;
+    return pBuffer;
+}
+
+/*
+ * Hands the buffer back when its thread exits, since GStreamer streaming
+ * threads come and go with every playback.
+ * */
+struct BufferOwner
+{
+    BufferOwner() : pBuffer(nullptr)
+    {
+    }
+
+    ~BufferOwner()
+    {
+        if (!pBuffer)
+            return;
+        lock_guard<mutex> Guard(BuffersLock);
+        pBuffer->InUse = false;
+    }
+
+    TraceBuffer* pBuffer;
+};
+
+static TraceBuffer* GetBuffer()
+{
+    static thread_local BufferOwner Owner;
+    if (!Owner.pBuffer)
+        Owner.pBuffer = AcquireBuffer();
+    return Owner.pBuffer;
+}
+
+// Earlier events stay in the rings until they are overwritten
+void Tracer::Start(const string& Filename)
+{
+    lock_guard<mutex> Guard(BuffersLock);
+    TraceFilename = Filename;
+    Enabled = true;
+}
+
+void Tracer::Stop()
+{
+    Enabled = false;
+}
+
+// Monotonic time in microseconds
+uint64_t Tracer::GetTime()
+{
+    using namespace chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::Add(const char* pName, const char* pCategory, uint64_t Begin, uint64_t Duration)
+{
+    TraceBuffer* pBuffer = GetBuffer();
+    uint64_t Head = pBuffer->Head.load(memory_order_relaxed);
+    TraceBuffer::Event& Event = pBuffer->Events[Head % TraceBuffer::CAPACITY];
+    strncpy(Event.Name, pName, sizeof(Event.Name) - 1);
+    Event.Name[sizeof(Event.Name) - 1] = '\0';
+    Event.pCategory = pCategory;
+    Event.Begin = Begin;
+    Event.Duration = Duration;
+    pBuffer->Head.store(Head + 1, memory_order_release);
+}
+
+static void WriteString(ostream& Stream, const char* pStr)
+{
+    Stream << '"';
+    for (; *pStr; ++pStr)
+    {
+        if (*pStr == '"' || *pStr == '\\')
+            Stream << '\\' << *pStr;
+        else if ((unsigned char)*pStr >= 0x20)
+            Stream << *pStr;
+    }
+    Stream << '"';
+}
+
+// Writes the latest events of every thread
+void Tracer::Flush()
+{
+    lock_guard<mutex> Guard(BuffersLock);
+    if (TraceFilename.empty())
+        return;
+
+    ofstream File(TraceFilename);
+    if (!File)
+    {
+        cout << "Cannot open trace file " << TraceFilename << endl;
+        return;
+    }
+
+    File << "{\"traceEvents\":[\n";
+    bool First = true;
+    vector<TraceBuffer::Event> Events;
+    for (auto& pBuffer : Buffers)
+    {
+        const uint64_t CAPACITY = TraceBuffer::CAPACITY;
+        uint64_t Head = pBuffer->Head.load(memory_order_acquire);
+        uint64_t Begin = Head > CAPACITY ? Head - CAPACITY : 0;
+        Events.clear();
+        for (uint64_t i = Begin; i < Head; ++i)
+            Events.push_back(pBuffer->Events[i % CAPACITY]);
+
+        // The owner overwrites slot Now - CAPACITY while recording event Now
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t Now = pBuffer->Head.load(memory_order_relaxed);
+        uint64_t Valid = Now >= CAPACITY ? Now - CAPACITY + 1 : 0;
+        for (uint64_t i = max(Begin, Valid); i < Head; ++i)
+        {
+            const TraceBuffer::Event& Event = Events[i - Begin];
+            File << (First ? "" : ",\n") << "{\"name\":";
+            WriteString(File, Event.Name);
+            File << ",\"cat\":\"" << Event.pCategory << "\",\"ph\":\"X\",\"ts\":" << Event.Begin
+                 << ",\"dur\":" << Event.Duration << ",\"pid\":1,\"tid\":" << pBuffer->Id << "}";
+            First = false;
+        }
+        if (Head > CAPACITY)
+            cout << "Trace buffer " << pBuffer->Id << " kept the last " << CAPACITY << " of " << Head << " events" << endl;
+    }
+    File << "\n]}\n";
+}
@@ -16,52 +16,133 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
 #include "Variable.hpp"
+#include "Bytecode.hpp"
 #include "nsbconstants.hpp"
 #include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 
-Variable::Variable() : Literal(true), Relative(false)
+static const int32_t MAX_ELEMENTS = 0x10000;
+const uint32_t Variable::NO_STRING;
+uint64_t Variable::NumStringAllocs = 0;
+
+Variable::Variable() : Tag(NSB_NULL), Relative(false), BoolValue(-1), StrSize(0), NameId(NO_STRING), StrId(NO_STRING), pArray(nullptr)
 {
+    Val.Int = 0;
+    Inline[0] = '\0';
 }
 
 Variable::~Variable()
 {
+    ClearString();
+    ClearArray();
+}
+
+void Variable::SetString(const char* pData, uint32_t Size)
+{
+    if (Size < INLINE_CAPACITY)
+    {
+        ClearString();
+        memcpy(Inline, pData, Size);
+        Inline[Size] = '\0';
+        StrSize = Size;
+        return;
+    }
+
+    // Reuse the heap buffer if it is large enough
+    if (StrSize != HEAP_STRING || Heap.Size < Size)
+    {
+        char* pNew = new char[Size + 1];
+        NumStringAllocs++;
+        ClearString();
+        Heap.pData = pNew;
+    }
+    memcpy(Heap.pData, pData, Size);
+    Heap.pData[Size] = '\0';
+    Heap.Size = Size;
+    StrSize = HEAP_STRING;
+}
+
+void Variable::ClearString()
+{
+    if (StrSize == HEAP_STRING)
+        delete[] Heap.pData;
+    Inline[0] = '\0';
+    StrSize = 0;
+}
+
+Variable::ArrayData* Variable::GetArray()
+{
+    if (!pArray)
+    {
+        pArray = new ArrayData;
+        pArray->NumElements = 0;
+    }
+    return pArray;
+}
+
+void Variable::ClearArray()
+{
+    if (!pArray)
+        return;
+
+    for (Variable* pElem : pArray->Elements)
+        delete pElem;
+    delete pArray;
+    pArray = nullptr;
 }
 
 void Variable::Set(int32_t Int)
 {
     Val.Int = Int;
-    Val.Str = "";
+    ClearString();
+    BoolValue = -1;
+    StrId = NO_STRING;
     Tag = NSB_INT;
 }
 
 void Variable::Set(float Float)
 {
     Val.Float = Float;
-    Val.Str = "";
+    ClearString();
+    BoolValue = -1;
+    StrId = NO_STRING;
     Tag = NSB_FLOAT;
 }
 
+/*
+ * Strings are classified once here so that IsInt, ToInt and ToBool
+ * do not need to look at the string again.
+ * */
 void Variable::Set(const string& Str)
 {
-    Val.Str = Str;
+    SetString(Str.c_str(), Str.size());
+    StrId = NO_STRING;
+    BoolValue = Nsb::ConstantToValue<Nsb::Boolean>(Str);
     // hack
     if (Str[0] == '@')
     {
-        Relative = true;
-        try
-        {
-            stoi(Val.Str.c_str() + 1);
-        }
-        catch(...)
-        {
-            Relative = false;
-        }
+        char* pEnd;
+        errno = 0;
+        long Value = strtol(Str.c_str() + 1, &pEnd, 10);
+        Relative = pEnd != Str.c_str() + 1 && errno != ERANGE &&
+            Value >= INT32_MIN && Value <= INT32_MAX;
     }
     Tag = NSB_STRING;
 }
 
+void Variable::SetLiteral(uint32_t Id)
+{
+    Set(Bytecode::GetString(Id));
+    StrId = Id;
+}
+
 void Variable::Initialize()
 {
+    ClearString();
+    BoolValue = -1;
+    StrId = NO_STRING;
     Tag = NSB_NULL;
 }
 
@@ -70,37 +151,18 @@ void Variable::Initialize(Variable* pVar)
     if (pVar->Tag == NSB_NULL)
         Initialize();
     else if (pVar->IsString())
+    {
         Set(pVar->ToString());
+        StrId = pVar->StrId;
+    }
     else
         Set(pVar->ToInt());
 }
 
-Variable* Variable::MakeFloat(float Float)
-{
-    Variable* pVar = new Variable;
-    pVar->Set(Float);
-    return pVar;
-}
-
-Variable* Variable::MakeInt(int32_t Int)
-{
-    Variable* pVar = new Variable;
-    pVar->Set(Int);
-    return pVar;
-}
-
-Variable* Variable::MakeString(const string& Str)
-{
-    Variable* pVar = new Variable;
-    pVar->Set(Str);
-    return pVar;
-}
-
 Variable* Variable::MakeNull(const string& Name)
 {
     Variable* pVar = new Variable;
-    pVar->Literal = false;
-    pVar->Name = Name;
+    pVar->NameId = Bytecode::Intern(Name);
     pVar->Initialize();
     return pVar;
 }
@@ -108,13 +170,17 @@ Variable* Variable::MakeNull(const string& Name)
 Variable* Variable::MakeCopy(Variable* pVar, const string& Name)
 {
     Variable* pNew = new Variable;
-    pNew->Literal = false;
-    pNew->Name = Name;
+    pNew->NameId = Bytecode::Intern(Name);
     pNew->Initialize(pVar);
-    Variable::Destroy(pVar);
     return pNew;
 }
 
+const string& Variable::GetName()
+{
+    static const string Empty;
+    return NameId == NO_STRING ? Empty : Bytecode::GetString(NameId);
+}
+
 int Variable::GetTag()
 {
     return Tag;
@@ -122,7 +188,9 @@ int Variable::GetTag()
 
 float Variable::ToFloat()
 {
-    return Val.Float;
+    if (Tag == NSB_FLOAT)
+        return Val.Float;
+    return ToInt();
 }
 
 int32_t Variable::ToInt()
@@ -132,12 +200,14 @@ int32_t Variable::ToInt()
 
     if (Tag == NSB_STRING)
     {
-        int32_t Value = Nsb::ConstantToValue<Nsb::Boolean>(ToString());
-        if (Value != -1)
-            return Value;
-        return Relative ? stoi(Val.Str.c_str() + 1) : 0;
+        if (BoolValue != -1)
+            return BoolValue;
+        return Relative ? strtol(GetData() + 1, nullptr, 10) : 0;
     }
 
+    if (Tag == NSB_FLOAT)
+        return Val.Float;
+
     return Val.Int;
 }
 
@@ -149,22 +219,18 @@ string Variable::ToString()
     if (Tag == NSB_INT)
         return Relative ? string("@") + to_string(Val.Int) : to_string(Val.Int);
 
-    return Val.Str;
+    return string(GetData(), GetSize());
 }
 
-bool Variable::IsFloat()
+// Boolean constants are folded into ToInt by Set
+bool Variable::ToBool()
 {
-    return Tag == NSB_FLOAT;
+    return ToInt() != 0;
 }
 
-bool Variable::IsInt()
-{
-    return Tag == NSB_INT || Tag == NSB_NULL || Relative || Nsb::ConstantToValue<Nsb::Boolean>(Val.Str) != -1;
-}
-
-bool Variable::IsString()
+bool Variable::IsFloat()
 {
-    return Tag == NSB_STRING || Tag == NSB_NULL || Relative;
+    return Tag == NSB_FLOAT;
 }
 
 bool Variable::IsNull()
@@ -179,25 +245,51 @@ void Variable::Set(Variable* pVar)
 
 Variable* Variable::IntUnaryOp(function<int32_t(int32_t)> Func)
 {
-    Val.Int = Func(Val.Int);
+    if (Tag != NSB_FLOAT)
+        Val.Int = Func(Val.Int);
     return this;
 }
 
-Variable* Variable::Add(Variable* pFirst, Variable* pSecond)
+const vector<Variable*>& Variable::GetElements()
 {
-    Variable* pThird = nullptr;
-    if (pFirst->IsInt())
-        pThird = MakeInt(pFirst->ToInt() + pSecond->ToInt());
-    else if (pFirst->IsString())
-        pThird = MakeString(pFirst->ToString() + pSecond->ToString());
+    static const vector<Variable*> Empty;
+    return pArray ? pArray->Elements : Empty;
+}
 
-    Destroy(pFirst);
-    Destroy(pSecond);
-    return pThird;
+map<string, int>& Variable::GetAssoc()
+{
+    return GetArray()->Assoc;
 }
 
-void Variable::Destroy(Variable* pVar)
+// Returns nullptr if Index cannot be stored in the array
+Variable* Variable::GetElement(int32_t Index)
 {
-    if (pVar->Literal)
-        delete pVar;
+    if (Index < 0 || Index >= MAX_ELEMENTS)
+        return nullptr;
+
+    ArrayData* pArr = GetArray();
+    if (Index >= (int32_t)pArr->Elements.size())
+        pArr->Elements.resize(Index + 1, nullptr);
+
+    if (!pArr->Elements[Index])
+    {
+        pArr->Elements[Index] = MakeNull(GetName() + "/" + to_string(Index));
+        pArr->NumElements++;
+    }
+    return pArr->Elements[Index];
+}
+
+Variable* Variable::ReadElement(int32_t Index)
+{
+    if (!pArray || Index < 0 || Index >= (int32_t)pArray->Elements.size())
+        return nullptr;
+    return pArray->Elements[Index];
+}
+
+void Variable::Add(Variable* pFirst, Variable* pSecond, Variable* pResult)
+{
+    if (pFirst->IsInt())
+        pResult->Set(pFirst->ToInt() + pSecond->ToInt());
+    else if (pFirst->IsString())
+        pResult->Set(pFirst->ToString() + pSecond->ToString());
 }
@@ -20,17 +20,29 @@
 #include "NSBInterpreter.hpp"
 #include "Window.hpp"
 #include "Texture.hpp"
+#include "Tracer.hpp"
+#include "TextureCache.hpp"
+#include "ImagePool.hpp"
+#include <cstdlib>
 
 uint32_t SDL_NSB_MOVECURSOR;
+uint32_t SDL_NSB_SIGNAL;
 Window* Object::pWindow = nullptr;
+atomic<uint32_t> Object::NextSerial(0);
 
-Window::Window(const char* WindowTitle, const int Width, const int Height) : WIDTH(Width), HEIGHT(Height), pInterpreter(nullptr), IsRunning(true), EventLoop(false)
+void Object::Signal()
+{
+    Window::PushSignalEvent(Serial);
+}
+
+Window::Window(const char* WindowTitle, const int Width, const int Height) : WIDTH(Width), HEIGHT(Height), pInterpreter(nullptr), FrameTime(0), IsRunning(true), EventLoop(false)
 {
     Object::pWindow = this;
     SDL_Init(SDL_INIT_VIDEO);
     SDLWindow = SDL_CreateWindow(WindowTitle, 0, 0, WIDTH, HEIGHT, SDL_WINDOW_OPENGL);
     GLContext = SDL_GL_CreateContext(SDLWindow);
     SDL_NSB_MOVECURSOR = SDL_RegisterEvents(1);
+    SDL_NSB_SIGNAL = SDL_RegisterEvents(1);
 
     GLenum err = glewInit();
     if (err != GLEW_OK)
@@ -44,10 +56,18 @@ Window::Window(const char* WindowTitle, const int Width, const int Height) : WID
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     glOrtho(0, WIDTH, HEIGHT, 0, -1, 1);
+    SetFrameRate(60);
+
+    if (const char* pTrace = getenv("NPENGINE_TRACE"))
+        Tracer::Start(pTrace);
+    ImagePool::Start();
 }
 
 Window::~Window()
 {
+    Tracer::Flush();
+    ImagePool::Shutdown();
+    TextureCache::Clear();
     SDL_GL_DeleteContext(GLContext);
     SDL_DestroyWindow(SDLWindow);
     SDL_Quit();
@@ -64,21 +84,110 @@ void Window::PushMoveCursorEvent(int X, int Y)
     SDL_PushEvent(&Event);
 }
 
+void Window::PushSignalEvent(uint32_t Serial)
+{
+    SDL_Event Event;
+    SDL_zero(Event);
+    Event.type = SDL_NSB_SIGNAL;
+    Event.user.data1 = reinterpret_cast<void*>(uintptr_t(Serial));
+    SDL_PushEvent(&Event);
+}
+
+/*
+ * The interpreter and redraws are paced to the frame rate, but only while
+ * there is something to do: runnable script threads, animating textures
+ * or a changed scene. Otherwise the loop sleeps until the next input event
+ * or script timer.
+ * */
 void Window::Run()
 {
-    LastDrawTime = SDL_GetTicks();
+    static const uint64_t MaxSleep = 1000000;
+    LastDrawTime = LastTickTime = GetTime();
+    uint64_t NextFrame = LastDrawTime;
+    uint64_t LastInstructions = pInterpreter->GetNumInstructions();
+    pInterpreter->SetSliceLimit(GetScriptBudget());
+    bool Dirty = true;
     SDL_Event Event;
     while (IsRunning)
     {
-        while (SDL_PollEvent(&Event))
-            HandleEvent(Event);
+        Tick();
+        pInterpreter->Run(GetScriptBudget());
+        if (pInterpreter->GetNumInstructions() != LastInstructions)
+        {
+            LastInstructions = pInterpreter->GetNumInstructions();
+            Dirty = true;
+        }
+
+        bool Busy = Dirty || !pInterpreter->IsIdle() || IsAnimating();
+        uint64_t Now = GetTime();
+        if (Busy && Now >= NextFrame)
+        {
+            Draw();
+            Dirty = false;
+            NextFrame = Now - NextFrame < FrameTime ? NextFrame + FrameTime : Now + FrameTime;
+            Now = GetTime();
+        }
 
-        Draw();
-        pInterpreter->Run(100);
-        SDL_Delay(10);
+        uint64_t WakeTime;
+        if (Busy)
+            WakeTime = NextFrame;
+        else
+            WakeTime = Now + min(MaxSleep, min(pInterpreter->GetNextDeadline(), MaxSleep / 1000) * 1000);
+
+        int Timeout = WakeTime > Now ? (WakeTime - Now + 999) / 1000 : 0;
+        if (SDL_WaitEventTimeout(&Event, Timeout))
+        {
+            HandleEvent(Event);
+            while (SDL_PollEvent(&Event))
+                HandleEvent(Event);
+            Dirty = true;
+        }
     }
 }
 
+/*
+ * Target frame rate of the main loop, or 0 to wait for vertical sync.
+ * */
+void Window::SetFrameRate(uint32_t Rate)
+{
+    SDL_GL_SetSwapInterval(Rate ? 0 : 1);
+    FrameTime = Rate ? 1000000 / Rate : 0;
+    if (pInterpreter)
+        pInterpreter->SetSliceLimit(GetScriptBudget());
+}
+
+// Time given to scripts each frame. A thread which takes longer on its own
+// is reported by the interpreter's watchdog.
+uint64_t Window::GetScriptBudget()
+{
+    return FrameTime ? FrameTime / 2 : 8000;
+}
+
+// Monotonic time in microseconds
+uint64_t Window::GetTime()
+{
+    static const uint64_t Frequency = SDL_GetPerformanceFrequency();
+    uint64_t Counter = SDL_GetPerformanceCounter();
+    return Counter / Frequency * 1000000 + Counter % Frequency * 1000000 / Frequency;
+}
+
+// Advances the script clock by whole milliseconds
+void Window::Tick()
+{
+    uint64_t Diff = (GetTime() - LastTickTime) / 1000;
+    LastTickTime += Diff * 1000;
+    if (Diff)
+        pInterpreter->Update(Diff);
+}
+
+bool Window::IsAnimating()
+{
+    for (Texture* pTex : Textures)
+        if (pTex->IsAnimating())
+            return true;
+    return false;
+}
+
 void Window::Exit()
 {
     IsRunning = false;
@@ -91,6 +200,9 @@ void Window::Select(bool Enable)
 
 void Window::HandleEvent(SDL_Event& Event)
 {
+    if (Event.type == SDL_NSB_SIGNAL)
+        return pInterpreter->OnSignal((uint32_t)(uintptr_t)Event.user.data1);
+
     if (Event.type == SDL_NSB_MOVECURSOR)
         MoveCursor((int64_t)Event.user.data1, (int64_t)Event.user.data2);
     else if (EventLoop)
@@ -101,16 +213,17 @@ void Window::HandleEvent(SDL_Event& Event)
 
 void Window::Draw()
 {
-    uint32_t CurrTime = SDL_GetTicks();
-    uint32_t Diff = CurrTime - LastDrawTime;
+    TraceScope Trace("Draw", "frame");
+    uint64_t Diff = (GetTime() - LastDrawTime) / 1000;
+    LastDrawTime += Diff * 1000;
     DrawTextures(Diff);
-    pInterpreter->Update(Diff);
+    TraceScope SwapTrace("Swap", "frame");
     SDL_GL_SwapWindow(SDLWindow);
-    LastDrawTime = CurrTime;
 }
 
 void Window::DrawTextures(uint32_t Diff)
 {
+    TraceScope Trace("DrawTextures", "frame");
     glClear(GL_COLOR_BUFFER_BIT);
     for (Texture* pTex : Textures)
         pTex->Draw(Diff);